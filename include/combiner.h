@@ -0,0 +1,87 @@
+/**
+*** :: Combiner ::
+***
+***   Merges the reports of the two halves of a Joy-Con pair
+***   into one synchronized frame, so consumers on the other
+***   side of uinput never see half of a controller update.
+***
+**/
+
+#ifndef combiner_h
+#define combiner_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/input.h>
+
+#include "joycons.h"
+#include "decoder.h"
+#include "statestore.h"
+#include "motion.h"
+#include "predictor.h"
+#include "timesync.h"
+#include "telemetry.h"
+
+/* A Joy-Con pair never has more than a left and a right half. */
+#define COMBINER_MAX_SOURCES (2)
+#define COMBINER_REPORT_SIZE (0x40)
+#define COMBINER_MAX_EVENTS (COMBINER_MAX_SOURCES * JOYCON_MAX_INPUT_EVENTS + MOTION_MAX_EVENTS + 2)
+
+/* How long a half may wait on its partner before the frame goes out anyway. */
+#define COMBINER_DEFAULT_DEADLINE_US (4000)
+
+/**
+ * One half of the controller, and the last report
+ * it handed us that hasn't been emitted yet.
+ * sample_us is when that report was sampled, going by its timer.
+ * trace is the trace slot of the controller it comes from.
+ */
+typedef struct combiner_source {
+    const JoyconDecoder *decoder;
+    int trace;
+    bool pending;
+    uint64_t arrival_us;
+    uint64_t sample_us;
+    TimeSync sync;
+    ControllerState state;
+    unsigned char report[COMBINER_REPORT_SIZE];
+} CombinerSource;
+
+struct frame_combiner;
+
+/* Called after every frame that went out, whichever path flushed it. */
+typedef void (*combiner_frame_callback)(const struct frame_combiner *combiner, uint64_t arrival_us, void *user);
+
+typedef struct frame_combiner {
+    int fd;
+    int num_sources;
+    uint64_t deadline_us;
+    uint64_t frame_open_us;
+    uint64_t frames_emitted;
+    uint64_t frame_us;
+    ControllerState state;
+    StateStore *store;
+    int store_device;
+    Motion *motion;
+    int motion_source;
+    Predictor *predictor;
+    TelemetryRecorder *telemetry;
+    combiner_frame_callback on_frame;
+    void *user;
+    CombinerSource sources[COMBINER_MAX_SOURCES];
+    struct input_event events[COMBINER_MAX_EVENTS];
+} FrameCombiner;
+
+void combiner_init(FrameCombiner *combiner, int fd, uint64_t deadline_us, StateStore *store, int first_device);
+void combiner_setup(int fd);
+int combiner_add_source(FrameCombiner *combiner, const JoyconDecoder *decoder, int trace);
+void combiner_attach_motion(FrameCombiner *combiner, Motion *motion, int source);
+void combiner_attach_predictor(FrameCombiner *combiner, Predictor *predictor);
+void combiner_attach_telemetry(FrameCombiner *combiner, TelemetryRecorder *telemetry);
+void combiner_on_frame(FrameCombiner *combiner, combiner_frame_callback on_frame, void *user);
+void combiner_push(FrameCombiner *combiner, int source, const unsigned char *report, int len, uint64_t now_us);
+int combiner_poll(FrameCombiner *combiner, uint64_t now_us);
+int combiner_flush(FrameCombiner *combiner);
+int combiner_predict(FrameCombiner *combiner, uint64_t now_us);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+/**
+*** :: Decoder ::
+***
+***   Event generation, per kind of controller, from one description
+***   of which button and stick goes where. Reports themselves are
+***   parsed by the state store. The kind gets picked once, when a
+***   controller is attached, so turning a state into events never
+***   has to ask what it's looking at.
+***
+**/
+
+#ifndef decoder_h
+#define decoder_h
+
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "joycons.h"
+
+/* Which half of a charging grip a handle belongs to. */
+#define JOYCON_HALF_LEFT (1)
+#define JOYCON_HALF_RIGHT (2)
+
+/**
+ * Most names here are pretty self explanatory.
+ * BTN_T(L/R)(1/2)
+ * is referring to the left and right trigger
+ * buttons. (1 and 2).
+ * Also known as ZL and ZR buttons.
+ * 
+ *    * FOR SUPER DUPER CLARITY;
+ *      BTN_TL1 -> [BTN_LEFT_TRIGGER == BTN_TL1]
+ *      BTN_TL2 -> [BTN_LEFT_ZTRIGGER == BTN_TL2]
+ *      BTN_TR1 -> [BTN_RIGHT_TRIGGER == BTN_TR1]
+ *      BTN_TR2 -> [BTN_RIGHT_ZTRIGGER == BTN_TR2] 
+ * 
+ * The next lists are an attempt at
+ * abridging the usually 2 seperate joycons together
+ * and having a funcitonal button and bitflag map,
+ * accurately representing what a simese joycon twin would
+ * look and act like. 
+ * 
+ * Each half is listed as BUTTON(report field, bit, uinput code)
+ * and STICK(x code, y code, ControllerState field)
+ * entries, in the order their events go out.
+ */
+#define JOYCON_MAP_LEFT(BUTTON, STICK) \
+    BUTTON(buttons_l, 0, BTN_DPAD_DOWN) \
+    BUTTON(buttons_l, 1, BTN_DPAD_UP) \
+    BUTTON(buttons_l, 2, BTN_DPAD_RIGHT) \
+    BUTTON(buttons_l, 3, BTN_DPAD_LEFT) \
+    BUTTON(buttons_l, 6, BTN_TL) \
+    BUTTON(buttons_l, 7, BTN_TL2) \
+    BUTTON(buttons_middle, 0, BTN_SELECT) \
+    BUTTON(buttons_middle, 3, BTN_THUMBL) \
+    BUTTON(buttons_middle, 5, BTN_Z) \
+    STICK(ABS_X, ABS_Y, stick_l)
+
+#define JOYCON_MAP_RIGHT(BUTTON, STICK) \
+    BUTTON(buttons_r, 0, BTN_WEST) \
+    BUTTON(buttons_r, 1, BTN_NORTH) \
+    BUTTON(buttons_r, 2, BTN_EAST) \
+    BUTTON(buttons_r, 3, BTN_SOUTH) \
+    BUTTON(buttons_r, 6, BTN_TR) \
+    BUTTON(buttons_r, 7, BTN_TR2) \
+    BUTTON(buttons_middle, 1, BTN_START) \
+    BUTTON(buttons_middle, 2, BTN_THUMBR) \
+    BUTTON(buttons_middle, 4, BTN_MODE) \
+    STICK(ABS_RX, ABS_RY, stick_r)
+
+/* The Pro Controller is both halves in one. */
+#define JOYCON_MAP_PRO(BUTTON, STICK) JOYCON_MAP_LEFT(BUTTON, STICK) JOYCON_MAP_RIGHT(BUTTON, STICK)
+
+typedef int (*joycon_emit_fn)(struct input_event *events, const ControllerState *state);
+typedef void (*joycon_merge_fn)(ControllerState *into, const ControllerState *state);
+
+/**
+ * emit turns a decoded state into uinput events, and merge copies
+ * the fields this kind covers into another state.
+ * type is the old left (1) / right (2) bitmask, for
+ * whoever still needs to know which halves are covered.
+ */
+typedef struct joycon_decoder {
+    const char *name;
+    int type;
+    joycon_emit_fn emit;
+    joycon_merge_fn merge;
+} JoyconDecoder;
+
+extern const JoyconDecoder joycon_decoder_left;
+extern const JoyconDecoder joycon_decoder_right;
+extern const JoyconDecoder joycon_decoder_pro;
+
+const JoyconDecoder *joycon_decoder_for(unsigned short product_id, int half);
+
+#endif
\ No newline at end of file
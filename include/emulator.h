@@ -0,0 +1,80 @@
+/**
+*** :: Emulator ::
+***
+***   A software model of the Joy-Con / Pro Controller firmware, for
+***   running Wyatt end to end without any hardware. It only deals in
+***   raw reports: what goes in is an output report as the host wrote
+***   it, what comes out is the input report the controller would
+***   answer with. tools/wyatt_uhid.c plugs it into /dev/uhid.
+***
+**/
+
+#ifndef emulator_h
+#define emulator_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "joycons.h"
+
+#define EMULATOR_FLASH_SIZE (0x80000)
+
+/* Large enough for a 0x31 report behind the USB header. */
+#define EMULATOR_MAX_REPORT (0x180)
+
+/* Joy-Con send their standard reports at roughly 60Hz over Bluetooth. */
+#define EMULATOR_DEFAULT_PERIOD_US (15000)
+
+/* Bytes 3..48 of a standard report: buttons, sticks, vibrator and IMU. */
+#define EMULATOR_FRAME_SIZE (46)
+
+typedef enum emulator_kind {
+    EMULATOR_JOYCON_L = 1,
+    EMULATOR_JOYCON_R = 2,
+    EMULATOR_PRO = 3,
+} EmulatorKind;
+
+/**
+ * One step of a script. hold_us of 0 means "for exactly one report",
+ * which is what every line of a capture turns into.
+ */
+typedef struct emulator_frame {
+    uint8_t input[EMULATOR_FRAME_SIZE];
+    uint32_t hold_us;
+} EmulatorFrame;
+
+typedef struct emulator_script {
+    int num_frames;
+    EmulatorFrame *frames;
+} EmulatorScript;
+
+typedef struct emulator {
+    EmulatorKind kind;
+    bool wired;
+    uint8_t mac[6];
+    uint8_t *flash;
+    uint8_t report_mode;
+    uint8_t player_lights;
+    bool imu_enabled;
+    bool vibration_enabled;
+    uint8_t timer;
+    uint64_t period_us;
+    uint64_t next_report_us;
+    uint8_t input[EMULATOR_FRAME_SIZE];
+    const EmulatorScript *script;
+    int script_frame;
+    uint64_t script_frame_us;
+    uint64_t reports_sent;
+    uint64_t subcommands_answered;
+} Emulator;
+
+int emulator_init(Emulator *em, EmulatorKind kind, bool wired, int index, const char *flash_path);
+void emulator_attach_script(Emulator *em, const EmulatorScript *script, uint64_t now_us);
+int emulator_output(Emulator *em, const uint8_t *data, int len, uint8_t *reply, uint64_t now_us);
+int emulator_poll(Emulator *em, uint8_t *report, uint64_t now_us);
+void emulator_free(Emulator *em);
+
+int emulator_script_load(EmulatorScript *script, const char *path);
+void emulator_script_free(EmulatorScript *script);
+
+#endif
\ No newline at end of file
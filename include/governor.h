@@ -0,0 +1,58 @@
+/**
+*** :: Governor ::
+***
+***   Decides how often the input poll loop asks the controllers
+***   for input, based on whether anyone is actually using them.
+***
+**/
+
+#ifndef governor_h
+#define governor_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "joycons.h"
+
+#define GOVERNOR_MAX_DEVICES (8)
+
+/* Raw 12 bit stick wiggle that doesn't count as the stick being used. */
+#define GOVERNOR_STICK_NOISE (24)
+
+#define GOVERNOR_DEFAULT_IDLE_AFTER_US (2000000)
+#define GOVERNOR_DEFAULT_IDLE_PERIOD_US (50000)
+#define GOVERNOR_CPU_WINDOW_US (1000000)
+
+typedef enum governor_mode {
+    GOVERNOR_ACTIVE,
+    GOVERNOR_IDLE,
+} GovernorMode;
+
+typedef struct governor_device {
+    bool valid;
+    uint64_t last_change_us;
+    ControllerState reference;
+} GovernorDevice;
+
+typedef struct governor {
+    GovernorMode mode;
+    uint64_t active_period_us;
+    uint64_t idle_period_us;
+    uint64_t idle_after_us;
+    uint64_t next_poll_us;
+    uint64_t polls;
+    uint64_t idle_polls;
+    uint64_t cpu_window_wall_us;
+    uint64_t cpu_window_cpu_us;
+    double cpu_load;
+    GovernorDevice devices[GOVERNOR_MAX_DEVICES];
+} Governor;
+
+void governor_init(Governor *governor, uint64_t active_period_us, uint64_t idle_period_us, uint64_t idle_after_us);
+void governor_observe(Governor *governor, int device, const ControllerState *state, uint64_t now_us);
+void governor_wait(Governor *governor);
+void governor_polled(Governor *governor, uint64_t now_us);
+const char *governor_mode_name(const Governor *governor);
+void governor_dump(const Governor *governor);
+
+#endif
\ No newline at end of file
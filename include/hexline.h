@@ -0,0 +1,16 @@
+/**
+*** :: Hexline ::
+***
+***   Reads back the reports hex_dump prints, for everything that
+***   replays a capture.
+***
+**/
+
+#ifndef hexline_h
+#define hexline_h
+
+#include <stdint.h>
+
+int hexline_parse(const char *line, uint8_t *out, int max);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,88 @@
+/**
+*** :: Hidraw ::
+***
+***   Alternative transport for the input poll loop, talking to
+***   /dev/hidrawN directly, with every read and write of a frame
+***   submitted to io_uring in one batch.
+***
+**/
+
+#ifndef hidraw_h
+#define hidraw_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HIDRAW_MAX_DEVICES (8)
+#define HIDRAW_READ_SLOTS (4)
+#define HIDRAW_REPORT_SIZE (0x400)
+#define HIDRAW_WRITE_SIZE (0x40)
+#define HIDRAW_RING_ENTRIES (64)
+
+/**
+ * A report slot is either in flight in the kernel, waiting for us
+ * to pick up what it got, or idle and waiting to be resubmitted.
+ */
+typedef enum hidraw_slot_state {
+    HIDRAW_SLOT_IDLE,
+    HIDRAW_SLOT_IN_FLIGHT,
+    HIDRAW_SLOT_READY,
+} HidrawSlotState;
+
+/**
+ * error is the errno of the last read or write that failed in the
+ * ring. Once it's one the device won't recover from, its reads stop
+ * getting rearmed and every call on it returns -1.
+ */
+typedef struct hidraw_device {
+    int fd;
+    int error;
+    uint8_t *write_buf;
+    int write_len;
+    bool write_queued;
+    bool write_in_flight;
+    uint8_t *read_buf[HIDRAW_READ_SLOTS];
+    int read_len[HIDRAW_READ_SLOTS];
+    HidrawSlotState read_state[HIDRAW_READ_SLOTS];
+    uint8_t ready[HIDRAW_READ_SLOTS];
+    int ready_head;
+    int ready_count;
+} HidrawDevice;
+
+typedef struct hidraw_transport {
+    bool uring;
+    int ring_fd;
+    int num_devices;
+    uint64_t syscalls;
+    uint64_t frames;
+    uint64_t writes_dropped;
+    
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_pending;
+    
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    
+    uint8_t *buffers;
+    HidrawDevice devices[HIDRAW_MAX_DEVICES];
+} HidrawTransport;
+
+int hidraw_open(HidrawTransport *transport, const char **paths, int count);
+int hidraw_write(HidrawTransport *transport, int device, const uint8_t *data, int len);
+int hidraw_submit(HidrawTransport *transport);
+int hidraw_read(HidrawTransport *transport, int device, uint8_t *data, int len);
+void hidraw_close(HidrawTransport *transport);
+
+#endif
\ No newline at end of file
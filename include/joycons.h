@@ -1,18 +1,68 @@
 #ifndef joycons_h
 #define joycons_h
 
+#include <stdint.h>
+#include <wchar.h>
+#include <linux/input.h>
+#include <hidapi/hidapi.h>
+
+/* Product ids of everything we know how to talk to. */
+#define JOYCON_L_BT (0x2006)
+#define JOYCON_R_BT (0x2007)
+#define PRO_CONTROLLER (0x2009)
+#define JOYCON_CHARGING_GRIP (0x200e)
+
+/* Upper bound of events a single decoder call can produce. */
+#define JOYCON_MAX_INPUT_EVENTS (32)
+
+/**
+ * Data structure of how an input packet
+ * is constructed, before being sent off.
+ * Each IMU sample is accel X/Y/Z then gyro X/Y/Z,
+ * as little endian int16s.
+ */
+typedef struct input_packet {
+    uint8_t header[8];
+    uint8_t unk1[2];
+    uint8_t report_id;
+    uint8_t timer;
+    uint8_t battery;
+    uint8_t buttons_r;
+    uint8_t buttons_middle;
+    uint8_t buttons_l;
+    uint8_t sticks[6];
+    uint8_t vibrator;
+    uint8_t imu[3][12];
+} InputPacket;
+
+/* Which bits of ControllerState.buttons belong to which half. */
+#define JOYCON_STATE_BUTTONS_LEFT (0xFF0000 | (0x29 << 8))
+#define JOYCON_STATE_BUTTONS_RIGHT (0x0000FF | (0x16 << 8))
+
+/**
+ * Decoded snapshot of a controller, independent of the
+ * report it came from.
+ * buttons is buttons_r | buttons_middle << 8 | buttons_l << 16,
+ * sticks are raw 12 bit X/Y pairs.
+ */
+typedef struct controller_state {
+    uint32_t buttons;
+    uint16_t stick_l[2];
+    uint16_t stick_r[2];
+} ControllerState;
+
 void hex_dump(unsigned char *buf, int len);
 void hid_exchange(hid_device *handle, unsigned char *buf, int len);
 int hid_dual_exchange(hid_device *handle_l, hid_device *handle_r, unsigned char *buf_l, unsigned char *buf_r, int len);
 void hid_dual_write(hid_device *handle_l, hid_device *handle_r, unsigned char *buf_l, unsigned char *buf_r, int len);
+int joycon_report_offset(void);
 void joycon_send_command(hid_device *handle, int command, uint8_t *data, int len);
 void joycon_send_subcommand(hid_device *handle, int command, int subcommand, uint8_t *data, int len);
 void spi_write(hid_device *handle, uint32_t offs, uint8_t *data, uint8_t len);
 void spi_read(hid_device *handle, uint32_t offs, uint8_t *data, uint8_t len);
 void spi_flash_dump(hid_device *handle, char *out_path);
-int joycon_init(hid_device *handle, const wchar_t *name);
+int joycon_init(hid_device *handle, const wchar_t *name, const char *trace_key);
 void joycon_deinit(hid_device *handle, const wchar_t *name);
 void device_print(struct hid_device_info *dev);
-void joycon_parse_input(int fd, unsigned char *data, int type);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+/**
+*** :: MCU ::
+***
+***   Drives the MCU of the right Joy-Con (IR camera, NFC) and
+***   reassembles the image fragments it piggybacks onto 0x31
+***   input reports back into whole frames.
+***
+**/
+
+#ifndef mcu_h
+#define mcu_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "joycons.h"
+
+/* Where the MCU data lives inside a standard 0x31 input report. */
+#define MCU_REPORT_ID_OFFSET (49)
+#define MCU_FRAGMENT_NUMBER_OFFSET (52)
+#define MCU_STATE_OFFSET (56)
+#define MCU_FRAGMENT_OFFSET (59)
+#define MCU_FRAGMENT_SIZE (300)
+#define MCU_REPORT_SIZE (MCU_FRAGMENT_OFFSET + MCU_FRAGMENT_SIZE)
+
+#define MCU_MAX_WIDTH (320)
+#define MCU_MAX_HEIGHT (240)
+#define MCU_MAX_FRAME_SIZE (MCU_MAX_WIDTH * MCU_MAX_HEIGHT)
+#define MCU_MAX_FRAGMENTS (MCU_MAX_FRAME_SIZE / MCU_FRAGMENT_SIZE)
+
+/* Completed frames stay valid until this many newer ones have come in. */
+#define MCU_FRAME_SLOTS (3)
+
+typedef struct mcu_frame {
+    uint16_t number;
+    uint16_t width;
+    uint16_t height;
+    uint32_t size;
+    uint8_t *pixels;
+} McuFrame;
+
+typedef void (*mcu_frame_callback)(const McuFrame *frame, void *user);
+
+typedef struct mcu {
+    bool streaming;
+    uint8_t state;
+    uint8_t resolution_reg;
+    uint8_t last_fragment;
+    uint16_t num_fragments;
+    uint16_t width;
+    uint16_t height;
+    int16_t missing;
+    int slot;
+    uint16_t frame_number;
+    uint64_t received[MCU_MAX_FRAGMENTS / 64];
+    uint64_t frames_completed;
+    uint64_t frames_dropped;
+    uint8_t *storage;
+    McuFrame frames[MCU_FRAME_SLOTS];
+    mcu_frame_callback on_frame;
+    void *user;
+} Mcu;
+
+int mcu_init(Mcu *mcu, int width, mcu_frame_callback on_frame, void *user);
+int mcu_start(Mcu *mcu, hid_device *handle);
+int mcu_feed(Mcu *mcu, const uint8_t *report, int len);
+void mcu_ack(Mcu *mcu, hid_device *handle);
+void mcu_stop(Mcu *mcu, hid_device *handle);
+void mcu_free(Mcu *mcu);
+
+#endif
\ No newline at end of file
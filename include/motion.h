@@ -0,0 +1,60 @@
+/**
+*** :: Motion ::
+***
+***   Turns the gyro samples of a controller into pointer motion
+***   (EV_REL) or right stick deflection, for gyro aiming.
+***
+**/
+
+#ifndef motion_h
+#define motion_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/input.h>
+
+#include "statestore.h"
+
+/* Most events a single call to motion_emit can produce. */
+#define MOTION_MAX_EVENTS (2)
+
+/* IMU samples are 5ms apart, three of them per report. */
+#define MOTION_SAMPLE_US (5000)
+
+/* Gyro at its default +-2000 dps range. */
+#define MOTION_DPS_PER_UNIT (0.070)
+
+#define MOTION_DEFAULT_SENSITIVITY (8.0)
+/* Full deflection at about 240 dps, a brisk flick of the wrist. */
+#define MOTION_DEFAULT_STICK_SENSITIVITY (0.4)
+#define MOTION_DEFAULT_ACCELERATION (0.0)
+#define MOTION_DEFAULT_SMOOTHING (8.0)
+
+typedef enum motion_mode {
+    MOTION_OFF,
+    MOTION_POINTER,
+    MOTION_STICK,
+} MotionMode;
+
+/**
+ * sensitivity is pointer counts per degree turned in pointer mode,
+ * and stick units per degree per second in stick mode.
+ * acceleration adds that much extra gain for every 100 dps of speed.
+ * Below smoothing dps, output is fully smoothed, above twice that not at all.
+ */
+typedef struct motion {
+    MotionMode mode;
+    double sensitivity;
+    double acceleration;
+    double smoothing;
+    double bias[3];
+    double smoothed[2];
+    double remainder[2];
+    uint64_t last_sample_us;
+} Motion;
+
+void motion_init(Motion *motion, MotionMode mode, double sensitivity, double acceleration, double smoothing);
+void motion_setup(Motion *motion, int fd);
+int motion_emit(Motion *motion, struct input_event *events, int count, const StateStore *store, int device, uint64_t sample_us);
+
+#endif
\ No newline at end of file
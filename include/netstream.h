@@ -0,0 +1,167 @@
+/**
+*** :: Netstream ::
+***
+***   Streams decoded controller state over a UDP or Unix
+***   datagram socket, as an alternative sink to uinput.
+***
+***   Wire format, all little endian:
+***
+***     0  magic      'W'
+***     1  kind       NETSTREAM_KIND_*
+***     2  seq        u16, per device
+***     4  device     u8
+***     5  mask       u8, which fields follow (NETSTREAM_FIELD_*)
+***     6  fields     in mask bit order
+***
+***   Buttons are 3 bytes, each stick is an X/Y pair packed
+***   into 3 bytes exactly like the controller sends it.
+***   Deltas only carry the fields that changed since the previous
+***   packet of that device, keyframes carry all of them.
+***
+***   Receivers subscribe with a hello, and leave with a bye, both as
+***
+***     2  nonce      8 bytes the receiver picked
+***    10  cookie     8 bytes, zero until the sender handed one out
+***
+***   A hello without the right cookie only gets a challenge of the
+***   same size back, carrying the cookie for that address and nonce.
+***   Nothing gets streamed to an address until it echoes it, so a
+***   spoofed hello can't turn the sender against someone else.
+***
+***   IR camera images go out as a run of image packets instead,
+***   with seq being the frame number and the header continuing as
+***
+***     5  chunk      u8
+***     6  chunks     u8
+***     7  width      u16
+***     9  height     u16
+***    11  pixels     up to NETSTREAM_IMAGE_CHUNK bytes
+***
+**/
+
+#ifndef netstream_h
+#define netstream_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "joycons.h"
+
+#define NETSTREAM_MAGIC (0x57)
+#define NETSTREAM_MAX_PACKET (64)
+#define NETSTREAM_MAX_DEVICES (8)
+#define NETSTREAM_MAX_SUBSCRIBERS (32)
+
+#define NETSTREAM_KIND_DELTA (0x00)
+#define NETSTREAM_KIND_KEYFRAME (0x01)
+#define NETSTREAM_KIND_HELLO (0x02)
+#define NETSTREAM_KIND_BYE (0x03)
+#define NETSTREAM_KIND_IMAGE (0x04)
+#define NETSTREAM_KIND_CHALLENGE (0x05)
+
+#define NETSTREAM_NONCE_SIZE (8)
+#define NETSTREAM_COOKIE_SIZE (8)
+#define NETSTREAM_HELLO_SIZE (2 + NETSTREAM_NONCE_SIZE + NETSTREAM_COOKIE_SIZE)
+
+#define NETSTREAM_FIELD_BUTTONS (1 << 0)
+#define NETSTREAM_FIELD_STICK_L (1 << 1)
+#define NETSTREAM_FIELD_STICK_R (1 << 2)
+#define NETSTREAM_FIELDS_ALL (0x07)
+
+#define NETSTREAM_IMAGE_HEADER (11)
+#define NETSTREAM_IMAGE_CHUNK (1200)
+#define NETSTREAM_MAX_IMAGE (320 * 240)
+#define NETSTREAM_MAX_IMAGE_CHUNKS (NETSTREAM_MAX_IMAGE / NETSTREAM_IMAGE_CHUNK)
+#define NETSTREAM_MAX_DATAGRAM (NETSTREAM_IMAGE_HEADER + NETSTREAM_IMAGE_CHUNK)
+
+#define NETSTREAM_DEFAULT_KEYFRAME_INTERVAL (128)
+#define NETSTREAM_DEFAULT_KEYFRAME_PERIOD_US (1000000)
+#define NETSTREAM_SUBSCRIBER_TIMEOUT_US (5000000)
+#define NETSTREAM_HELLO_PERIOD_US (1000000)
+
+/* A keyframe this far behind means the sender started over, not that it's stale. */
+#define NETSTREAM_RESTART_GAP (1024)
+
+typedef struct netstream_subscriber {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint64_t last_seen_us;
+} NetStreamSubscriber;
+
+/**
+ * Sender side bookkeeping of a single device,
+ * what we last told everyone about it.
+ */
+typedef struct netstream_device {
+    bool valid;
+    bool force_keyframe;
+    uint16_t seq;
+    uint32_t since_keyframe;
+    uint64_t keyframe_us;
+    ControllerState last;
+} NetStreamDevice;
+
+typedef struct netstream {
+    int fd;
+    char path[108];
+    int num_subscribers;
+    uint32_t keyframe_interval;
+    uint64_t keyframe_period_us;
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t secret[2];
+    NetStreamSubscriber subscribers[NETSTREAM_MAX_SUBSCRIBERS];
+    NetStreamDevice devices[NETSTREAM_MAX_DEVICES];
+} NetStream;
+
+/**
+ * Receiver side view of a single device.
+ * synced is false from the moment a packet went missing
+ * until the next keyframe comes in.
+ */
+typedef struct netstream_remote_device {
+    bool seen;
+    bool synced;
+    uint16_t seq;
+    uint32_t lost;
+    ControllerState state;
+} NetStreamRemoteDevice;
+
+/**
+ * Receiver side reassembly of the latest camera image.
+ */
+typedef struct netstream_image {
+    bool complete;
+    int device;
+    uint16_t frame;
+    uint16_t width;
+    uint16_t height;
+    uint8_t chunks;
+    uint64_t received;
+    uint8_t pixels[NETSTREAM_MAX_IMAGE];
+} NetStreamImage;
+
+typedef struct netstream_receiver {
+    int fd;
+    uint8_t last_kind;
+    struct sockaddr_storage server;
+    socklen_t server_len;
+    uint64_t last_hello_us;
+    uint8_t nonce[NETSTREAM_NONCE_SIZE];
+    uint8_t cookie[NETSTREAM_COOKIE_SIZE];
+    NetStreamRemoteDevice devices[NETSTREAM_MAX_DEVICES];
+    NetStreamImage image;
+} NetStreamReceiver;
+
+int netstream_open(NetStream *ns, const char *spec);
+void netstream_service(NetStream *ns, uint64_t now_us);
+int netstream_publish(NetStream *ns, int device, const ControllerState *state, uint64_t now_us);
+int netstream_publish_image(NetStream *ns, int device, uint16_t frame, uint16_t width, uint16_t height, const uint8_t *pixels);
+void netstream_close(NetStream *ns);
+
+int netstream_subscribe(NetStreamReceiver *rx, const char *spec);
+int netstream_receive(NetStreamReceiver *rx, int timeout_ms);
+void netstream_unsubscribe(NetStreamReceiver *rx);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+/**
+*** :: Predictor ::
+***
+***   Extrapolates stick positions between reports, so stick motion
+***   reaches uinput without waiting a whole report interval.
+***
+**/
+
+#ifndef predictor_h
+#define predictor_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/input.h>
+
+#include "joycons.h"
+
+/* ABS_X, ABS_Y, ABS_RX, ABS_RY, in that order. */
+#define PREDICTOR_AXES (4)
+#define PREDICTOR_AXIS_LEFT (0x3)
+#define PREDICTOR_AXIS_RIGHT (0xC)
+
+#define PREDICTOR_DEFAULT_PERIOD_US (4000)
+#define PREDICTOR_DEFAULT_HORIZON_US (12000)
+#define PREDICTOR_DEFAULT_SMOOTHING (0.5)
+
+/**
+ * value and velocity are in the same units the sticks go out
+ * to uinput with, velocity per microsecond.
+ */
+typedef struct predictor_axis {
+    bool valid;
+    double value;
+    double velocity;
+    int emitted;
+} PredictorAxis;
+
+/**
+ * period_us is how often predicted values go out between reports,
+ * horizon_us how far past the last real sample we dare to guess.
+ */
+typedef struct predictor {
+    unsigned int axis_mask;
+    uint64_t period_us;
+    uint64_t horizon_us;
+    double smoothing;
+    bool have_sample[2];
+    uint64_t last_sample_us[2];
+    uint64_t next_tick_us;
+    uint64_t predictions_emitted;
+    PredictorAxis axes[PREDICTOR_AXES];
+} Predictor;
+
+void predictor_init(Predictor *predictor, unsigned int axis_mask, uint64_t period_us, uint64_t horizon_us, double smoothing);
+void predictor_observe(Predictor *predictor, int type, const ControllerState *state, uint64_t sample_us);
+int predictor_emit(Predictor *predictor, struct input_event *events, uint64_t now_us, uint64_t *predicted_us);
+
+#endif
\ No newline at end of file
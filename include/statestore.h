@@ -0,0 +1,48 @@
+/**
+*** :: Statestore ::
+***
+***   Structure-of-arrays store for the decoded state of every
+***   attached controller, and a batch decoder that fills it
+***   from many pending input reports at once.
+***
+**/
+
+#ifndef statestore_h
+#define statestore_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "joycons.h"
+
+/* Multiple of the SIMD batch width, so every lane has a home. */
+#define STATESTORE_MAX_DEVICES (64)
+#define STATESTORE_BATCH (8)
+#define STATESTORE_IMU_SAMPLES (3)
+
+/* Only the bits that are a button on either half make it into a lane. */
+#define STATESTORE_BUTTONS_MASK (JOYCON_STATE_BUTTONS_LEFT | JOYCON_STATE_BUTTONS_RIGHT)
+
+/**
+ * One lane per device in every array. Buttons and sticks follow
+ * the same layout and masking as ControllerState, IMU lanes are
+ * indexed as [axis][sample][device].
+ */
+typedef struct state_store {
+    uint32_t buttons[STATESTORE_MAX_DEVICES] __attribute__((aligned(16)));
+    uint16_t stick_lx[STATESTORE_MAX_DEVICES] __attribute__((aligned(16)));
+    uint16_t stick_ly[STATESTORE_MAX_DEVICES] __attribute__((aligned(16)));
+    uint16_t stick_rx[STATESTORE_MAX_DEVICES] __attribute__((aligned(16)));
+    uint16_t stick_ry[STATESTORE_MAX_DEVICES] __attribute__((aligned(16)));
+    int16_t accel[3][STATESTORE_IMU_SAMPLES][STATESTORE_MAX_DEVICES] __attribute__((aligned(16)));
+    int16_t gyro[3][STATESTORE_IMU_SAMPLES][STATESTORE_MAX_DEVICES] __attribute__((aligned(16)));
+    uint8_t timer[STATESTORE_MAX_DEVICES];
+    uint64_t updated_us[STATESTORE_MAX_DEVICES];
+} StateStore;
+
+void statestore_init(StateStore *store);
+void statestore_decode(StateStore *store, const int *devices, unsigned char *const *reports, int count, uint64_t now_us);
+void statestore_decode_scalar(StateStore *store, const int *devices, unsigned char *const *reports, int count, uint64_t now_us);
+void statestore_get(const StateStore *store, int device, ControllerState *state);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+/**
+*** :: Telemetry ::
+***
+***   Long term recording of decoded IMU and stick data, one sample
+***   per IMU reading (200 Hz), for QA and tuning.
+***
+***   The input thread only ever pushes samples into a ring. A
+***   background thread drains it, gathers up to a block worth of
+***   samples per device, and writes each block out column by column,
+***   into a new file every rotation period.
+***
+***   File format, all little endian:
+***
+***     0  magic      "WTLM"
+***     4  version    u16
+***     6  reserved   u16
+***     8  mono_us    u64, host monotonic clock when the file was opened
+***    16  wall_us    u64, wall clock at that same moment
+***
+***   followed by blocks of
+***
+***     0  magic      'T'
+***     1  device     u8
+***     2  count      u16, samples in this block
+***     4  size       u32, bytes of column data that follow
+***     8  first_us   u64, monotonic time of the first sample
+***    16  last_us    u64, and of the last one
+***    24  columns    time, buttons, left X/Y, right X/Y, accel X/Y/Z, gyro X/Y/Z
+***
+***   Each column is a run of residuals, split into groups of
+***   TELEMETRY_GROUP. A group is one byte of bit width, followed by
+***   every residual of the group packed into that many bits, LSB first.
+***   Time residuals are zigzagged deltas of deltas, buttons are XORed
+***   with the previous sample, everything else is a zigzagged delta.
+***   The first sample of a block is relative to zero (and first_us),
+***   so every block decodes on its own.
+***
+**/
+
+#ifndef telemetry_h
+#define telemetry_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "joycons.h"
+#include "statestore.h"
+
+#define TELEMETRY_MAGIC "WTLM"
+#define TELEMETRY_VERSION (1)
+#define TELEMETRY_BLOCK_MAGIC ('T')
+#define TELEMETRY_FILE_HEADER (24)
+#define TELEMETRY_BLOCK_HEADER (24)
+
+#define TELEMETRY_MAX_DEVICES (8)
+#define TELEMETRY_COLUMNS (12)
+#define TELEMETRY_GROUP (32)
+#define TELEMETRY_BLOCK_SAMPLES (1024)
+
+/* Worst case, every residual of every column at full width. */
+#define TELEMETRY_MAX_BLOCK (TELEMETRY_COLUMNS * (TELEMETRY_BLOCK_SAMPLES / TELEMETRY_GROUP) * (1 + TELEMETRY_GROUP * 4))
+
+/* Has to be a power of two. About 4 seconds of both halves at 200 Hz. */
+#define TELEMETRY_RING_SIZE (2048)
+
+/* A block never spans a gap this long, which also keeps the time residuals in 32 bits. */
+#define TELEMETRY_MAX_GAP_US (1000000)
+
+/* How many files with the same second in their name we'll go through. */
+#define TELEMETRY_MAX_SUFFIX (100)
+
+#define TELEMETRY_DEFAULT_ROTATE_US (3600ULL * 1000000)
+#define TELEMETRY_FLUSH_PERIOD_US (5000000)
+#define TELEMETRY_IDLE_SLEEP_US (20000)
+
+/**
+ * One IMU reading, along with the buttons and sticks
+ * of the report it came in. Sticks are raw 12 bit.
+ */
+typedef struct telemetry_sample {
+    uint64_t sample_us;
+    uint32_t buttons;
+    uint16_t sticks[4];
+    int16_t accel[3];
+    int16_t gyro[3];
+    uint8_t device;
+} TelemetrySample;
+
+/**
+ * Samples of one device waiting to become a block.
+ */
+typedef struct telemetry_block {
+    int count;
+    TelemetrySample samples[TELEMETRY_BLOCK_SAMPLES];
+} TelemetryBlock;
+
+/**
+ * The ring is single producer (whoever calls telemetry_record)
+ * and single consumer (the writer thread). Everything below the
+ * ring belongs to the writer thread once it's running.
+ */
+typedef struct telemetry_recorder {
+    bool running;
+    pthread_t thread;
+    atomic_bool stop;
+    
+    // Producer side
+    atomic_uint head;
+    uint64_t last_us[TELEMETRY_MAX_DEVICES];
+    atomic_ullong dropped;
+    
+    // Consumer side
+    atomic_uint tail;
+    TelemetrySample *ring;
+    TelemetryBlock *blocks;
+    uint8_t *buffer;
+    char dir[4096];
+    FILE *file;
+    uint64_t rotate_us;
+    uint64_t file_opened_us;
+    uint64_t flushed_us;
+    atomic_ullong samples_written;
+    atomic_ullong bytes_written;
+} TelemetryRecorder;
+
+int telemetry_open(TelemetryRecorder *recorder, const char *dir, uint64_t rotate_us);
+void telemetry_record(TelemetryRecorder *recorder, int device, const ControllerState *state, const StateStore *store, int store_device, uint64_t sample_us);
+void telemetry_close(TelemetryRecorder *recorder);
+
+int telemetry_encode_block(const TelemetrySample *samples, int count, uint8_t *out);
+int telemetry_decode_block(const uint8_t *in, int size, int count, uint64_t first_us, TelemetrySample *samples);
+
+#endif
\ No newline at end of file
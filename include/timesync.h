@@ -0,0 +1,44 @@
+/**
+*** :: TimeSync ::
+***
+***   Maps the 8 bit timer every input report carries onto the
+***   host's monotonic clock, so we know when a sample was taken
+***   rather than just when it finally reached us.
+***
+**/
+
+#ifndef timesync_h
+#define timesync_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Timer ticks it takes before the learned tick length is trusted. */
+#define TIMESYNC_MIN_TICKS (64)
+
+/**
+ * ticks is the timer unwrapped into a 64 bit count since the anchor,
+ * offset_us the host time of tick 0 as seen by the least delayed
+ * report so far. The rest is a running least squares fit of arrival
+ * time (since the anchor) over ticks, whose slope is tick_us.
+ */
+typedef struct timesync {
+    bool valid;
+    uint8_t last_timer;
+    uint64_t ticks;
+    uint64_t anchor_us;
+    uint64_t last_arrival_us;
+    uint64_t last_sample_us;
+    double tick_us;
+    double offset_us;
+    uint64_t samples;
+    double mean_ticks;
+    double mean_arrival;
+    double sxx;
+    double sxy;
+} TimeSync;
+
+void timesync_init(TimeSync *sync);
+uint64_t timesync_map(TimeSync *sync, uint8_t timer, uint64_t arrival_us);
+
+#endif
\ No newline at end of file
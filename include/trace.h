@@ -0,0 +1,80 @@
+/**
+*** :: Trace ::
+***
+***   Static probe points and per-device counters along the I/O path,
+***   so a running instance can be looked at without a DEBUG_PRINT build.
+***
+***   Probes show up as USDT probes (provider "wyatt") whenever the
+***   build host has <sys/sdt.h>, and cost a single nop when nobody is
+***   attached. Setting WYATT_TRACE=1 also writes them into the kernel
+***   trace_marker, for perf/ftrace setups without USDT support.
+***
+**/
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_HAVE_SDT
+#endif
+#endif
+
+#define TRACE_MAX_DEVICES (8)
+
+/* Anything we can't put a name to ends up counted here. */
+#define TRACE_UNKNOWN_DEVICE (TRACE_MAX_DEVICES - 1)
+
+/**
+ * key is what tells two controllers apart, name is only
+ * there to make the dump readable.
+ */
+typedef struct trace_device {
+    const void *handle;
+    char key[64];
+    char name[32];
+    _Atomic uint64_t exchanges;
+    _Atomic uint64_t reports;
+    _Atomic uint64_t subcommands;
+    _Atomic uint64_t retries;
+    _Atomic uint64_t reconnects;
+} TraceDevice;
+
+/* Left global on purpose, gdb and bpftrace can read them straight out of a live process. */
+extern TraceDevice trace_devices[TRACE_MAX_DEVICES];
+extern int trace_marker_fd;
+
+#ifdef TRACE_HAVE_SDT
+#define TRACE_SDT(name, device, arg) DTRACE_PROBE2(wyatt, name, device, arg)
+#else
+#define TRACE_SDT(name, device, arg) do {} while(0)
+#endif
+
+/**
+ * Fires the probe point `name`. Both arguments are plain integers:
+ * the trace device slot, and whatever is most useful at that point.
+ */
+#define TRACE(name, device, arg) do { \
+    TRACE_SDT(name, device, arg); \
+    if(__builtin_expect(trace_marker_fd >= 0, 0)) \
+        trace_mark(#name, (device), (long)(arg)); \
+} while(0)
+
+/* Bumps one of the counters of a trace device slot. */
+#define TRACE_COUNT(device, counter) \
+    atomic_fetch_add_explicit(&trace_devices[(device)].counter, 1, memory_order_relaxed)
+
+void trace_init(void);
+int trace_register(const void *handle, const char *key, const char *name);
+void trace_unregister(const void *handle);
+int trace_lookup(const void *handle);
+void trace_mark(const char *name, int device, long arg);
+bool trace_service(void);
+void trace_dump(void);
+
+#endif
\ No newline at end of file
@@ -12,9 +12,20 @@
 #ifndef wengine_h
 #define wengine_h
 
+#include <stdint.h>
 
+/**
+ * Current time of the host's monotonic clock, in microseconds.
+ * Used for everything that needs to measure time between reports,
+ * since gettimeofday() can jump around underneath us.
+ */
+uint64_t wengine_now_us(void);
 
-
-
+/**
+ * Reads an integer tunable from the environment, falling back
+ * to the given default when it's unset or garbage.
+ */
+long wengine_env_long(const char *name, long fallback);
+double wengine_env_double(const char *name, double fallback);
 
 #endif
\ No newline at end of file
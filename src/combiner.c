@@ -0,0 +1,270 @@
+/**
+*** :: combiner.c ::
+***
+***   Each half of a Joy-Con pair is its own HID device and reports
+***   on its own schedule. If we just forwarded every report as it
+***   came in, a consumer would see the left stick of one update next
+***   to the right buttons of the previous one, and an EV_SYN for
+***   every loop iteration whether or not anything happened.
+***
+***   The combiner holds on to the newest report of each half, and
+***   once every half has checked in (or the deadline for the late
+***   one has passed) it decodes them all into a single batch of
+***   events, closes it with one EV_SYN and hands it to uinput in
+***   one write.
+***
+**/
+
+#include "combiner.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <stddef.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+
+/**
+ * Sets up an empty combiner writing into the given uinput fd.
+ * Reports are decoded into store, source i going into device
+ * first_device + i. Sources have to be added before anything
+ * can be pushed.
+ */
+void combiner_init(FrameCombiner *combiner, int fd, uint64_t deadline_us, StateStore *store, int first_device) {
+    memset(combiner, 0, sizeof(FrameCombiner));
+    combiner->fd = fd;
+    combiner->store = store;
+    combiner->store_device = first_device;
+    combiner->deadline_us = deadline_us;
+}
+
+/**
+ * Advertises the MSC_TIMESTAMP every frame carries.
+ * Has to happen before UI_DEV_CREATE.
+ */
+void combiner_setup(int fd) {
+    ioctl(fd, UI_SET_EVBIT, EV_MSC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_TIMESTAMP);
+}
+
+/**
+ * Registers a half of the controller, decoded with the given
+ * decoder, and traced under the given trace slot. Returns its
+ * source index, or -1 if we're full or there's nothing to decode it with.
+ */
+int combiner_add_source(FrameCombiner *combiner, const JoyconDecoder *decoder, int trace) {
+    if(combiner->num_sources >= COMBINER_MAX_SOURCES || !decoder) return -1;
+    
+    CombinerSource *source = &combiner->sources[combiner->num_sources];
+    memset(source, 0, sizeof(CombinerSource));
+    source->decoder = decoder;
+    source->trace = trace;
+    timesync_init(&source->sync);
+    
+    return combiner->num_sources++;
+}
+
+/**
+ * Has the gyro of the given source drive pointer or stick motion,
+ * emitted as part of the same frame as its buttons.
+ */
+void combiner_attach_motion(FrameCombiner *combiner, Motion *motion, int source) {
+    combiner->motion = motion;
+    combiner->motion_source = source;
+}
+
+/**
+ * Lets the predictor follow every frame that goes out, so
+ * combiner_predict can fill in the gaps between them.
+ */
+void combiner_attach_predictor(FrameCombiner *combiner, Predictor *predictor) {
+    combiner->predictor = predictor;
+}
+
+/**
+ * Records every half that goes out, IMU and all, as source i.
+ */
+void combiner_attach_telemetry(FrameCombiner *combiner, TelemetryRecorder *telemetry) {
+    combiner->telemetry = telemetry;
+}
+
+/**
+ * Has on_frame called with every frame that goes out, including the
+ * ones combiner_push flushes on its own, so sinks other than uinput
+ * don't miss a transition that came and went within one poll.
+ */
+void combiner_on_frame(FrameCombiner *combiner, combiner_frame_callback on_frame, void *user) {
+    combiner->on_frame = on_frame;
+    combiner->user = user;
+}
+
+/**
+ * Hands a fresh report of one half to the combiner, starting at
+ * its report id (0x30 or 0x31) and len bytes long. If that half already has a report waiting, the frame it belongs
+ * to is flushed first, so no button transition ever gets lost.
+ */
+void combiner_push(FrameCombiner *combiner, int source, const unsigned char *report, int len, uint64_t now_us) {
+    if(source < 0 || source >= combiner->num_sources) return;
+    
+    CombinerSource *src = &combiner->sources[source];
+    if(src->pending) {
+        combiner_flush(combiner);
+    }
+    
+    bool frame_open = false;
+    for(int i = 0; i < combiner->num_sources; i++) {
+        frame_open |= combiner->sources[i].pending;
+    }
+    if(!frame_open) {
+        combiner->frame_open_us = now_us;
+    }
+    
+    // Lined up with InputPacket, whatever the transport put in front of the id
+    int room = COMBINER_REPORT_SIZE - offsetof(InputPacket, report_id);
+    memset(src->report, 0, COMBINER_REPORT_SIZE);
+    memcpy(src->report + offsetof(InputPacket, report_id), report, len < room ? len : room);
+    src->arrival_us = now_us;
+    src->sample_us = timesync_map(&src->sync, ((InputPacket*)src->report)->timer, now_us);
+    src->pending = true;
+}
+
+/**
+ * Ends a batch of events with the time it belongs to and an EV_SYN.
+ * MSC_TIMESTAMP is in microseconds and wraps, so only its low 32 bits go out.
+ */
+static int combiner_close_frame(FrameCombiner *combiner, int count, uint64_t frame_us) {
+    struct input_event *ev = &combiner->events[count];
+    
+    memset(ev, 0, sizeof(struct input_event));
+    ev->type = EV_MSC;
+    ev->code = MSC_TIMESTAMP;
+    ev->value = (int32_t)(uint32_t)frame_us;
+    ev++;
+    
+    memset(ev, 0, sizeof(struct input_event));
+    ev->type = EV_SYN;
+    ev->code = SYN_REPORT;
+    ev->value = 0;
+    
+    return count + 2;
+}
+
+/**
+ * Emits the current frame if it's complete, or if the
+ * halves that are missing have run out of time.
+ * Returns the number of events written, 0 if the frame is still open.
+ */
+int combiner_poll(FrameCombiner *combiner, uint64_t now_us) {
+    int pending = 0;
+    
+    for(int i = 0; i < combiner->num_sources; i++) {
+        if(combiner->sources[i].pending) pending++;
+    }
+    
+    if(pending == 0) return 0;
+    
+    if(pending < combiner->num_sources
+        && now_us - combiner->frame_open_us < combiner->deadline_us)
+        return 0;
+    
+    return combiner_flush(combiner);
+}
+
+/**
+ * Decodes every pending half into one batch of events, terminated
+ * by a single EV_SYN, and writes it out. Nothing at all is written
+ * if there was nothing pending. The combined state of the controller
+ * is kept up to date in combiner->state along the way, and that of
+ * each half in its own source. Every report is decoded exactly once,
+ * into the state store, and the rest comes out of there.
+ * Returns the number of events written.
+ */
+int combiner_flush(FrameCombiner *combiner) {
+    int devices[COMBINER_MAX_SOURCES];
+    unsigned char *reports[COMBINER_MAX_SOURCES];
+    uint64_t arrival_us = 0;
+    uint64_t sample_us = 0;
+    int pending = 0;
+    int count = 0;
+    
+    for(int i = 0; i < combiner->num_sources; i++) {
+        CombinerSource *src = &combiner->sources[i];
+        if(!src->pending) continue;
+        
+        devices[pending] = combiner->store_device + i;
+        reports[pending++] = src->report;
+        if(src->arrival_us > arrival_us) {
+            arrival_us = src->arrival_us;
+        }
+        if(src->sample_us > sample_us) {
+            sample_us = src->sample_us;
+        }
+    }
+    
+    // The one pass over the reports, everything else works off the store
+    statestore_decode(combiner->store, devices, reports, pending, arrival_us);
+    
+    for(int i = 0; i < combiner->num_sources; i++) {
+        CombinerSource *src = &combiner->sources[i];
+        if(!src->pending) continue;
+        
+        // parse_entry/parse_exit bracket the events of each half
+        TRACE(parse_entry, src->trace, combiner->frames_emitted);
+        int first = count;
+        int device = combiner->store_device + i;
+        ControllerState decoded;
+        
+        statestore_get(combiner->store, device, &decoded);
+        src->decoder->merge(&src->state, &decoded);
+        src->decoder->merge(&combiner->state, &decoded);
+        count += src->decoder->emit(&combiner->events[count], &src->state);
+        if(combiner->predictor) {
+            predictor_observe(combiner->predictor, src->decoder->type, &src->state, src->sample_us);
+        }
+        src->pending = false;
+        
+        if(combiner->telemetry) {
+            telemetry_record(combiner->telemetry, i, &src->state, combiner->store, device, src->sample_us);
+        }
+        if(combiner->motion && i == combiner->motion_source) {
+            count = motion_emit(combiner->motion, combiner->events, count, combiner->store, device, src->sample_us);
+        }
+        TRACE(parse_exit, src->trace, count - first);
+    }
+    
+    if(count == 0) return 0;
+    
+    combiner->frame_us = sample_us;
+    count = combiner_close_frame(combiner, count, sample_us);
+    
+    write(combiner->fd, combiner->events, count * sizeof(struct input_event));
+    combiner->frames_emitted++;
+    
+    if(combiner->on_frame) {
+        combiner->on_frame(combiner, arrival_us, combiner->user);
+    }
+    
+    return count;
+}
+
+/**
+ * Sends out predicted stick values between frames, when the
+ * predictor's next tick is due. Returns the number of events
+ * written, including the EV_SYN.
+ */
+int combiner_predict(FrameCombiner *combiner, uint64_t now_us) {
+    if(!combiner->predictor) return 0;
+    
+    uint64_t predicted_us;
+    int count = predictor_emit(combiner->predictor, combiner->events, now_us, &predicted_us);
+    if(count == 0) return 0;
+    
+    // Stamped like a real frame, with the time the values are for
+    count = combiner_close_frame(combiner, count, predicted_us);
+    
+    write(combiner->fd, combiner->events, count * sizeof(struct input_event));
+    return count;
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+/**
+*** :: decoder.c ::
+***
+***   Stamps out an emit / merge pair for every kind of controller from
+***   the maps in decoder.h. Everything the old type mask used to decide
+***   per report is settled at compile time here, so each generated
+***   function is a straight run of loads and stores.
+***
+**/
+
+#include "decoder.h"
+
+#include <stdint.h>
+
+/* Where each report byte's bits sit in ControllerState.buttons, see statestore.c. */
+#define JOYCON_SHIFT_buttons_r (0)
+#define JOYCON_SHIFT_buttons_middle (8)
+#define JOYCON_SHIFT_buttons_l (16)
+
+#define JOYCON_EMIT_BUTTON(field, bit, key) \
+    *ev++ = (struct input_event){.type = EV_KEY, .code = (key), \
+        .value = (state->buttons >> (JOYCON_SHIFT_##field + (bit))) & 1};
+
+/* Sticks go out as their top 8 bits, Y flipped so up is up. */
+#define JOYCON_EMIT_STICK(code_x, code_y, field) \
+    *ev++ = (struct input_event){.type = EV_ABS, .code = (code_x), .value = state->field[0] >> 4}; \
+    *ev++ = (struct input_event){.type = EV_ABS, .code = (code_y), .value = 256 - (state->field[1] >> 4)};
+
+#define JOYCON_MERGE_STICK(code_x, code_y, field) \
+    into->field[0] = state->field[0]; \
+    into->field[1] = state->field[1];
+
+#define JOYCON_SKIP_BUTTON(field, bit, key)
+
+#define JOYCON_DEFINE_DECODER(kind, type, mask, MAP) \
+    static int joycon_emit_##kind(struct input_event *events, const ControllerState *state) { \
+        struct input_event *ev = events; \
+        MAP(JOYCON_EMIT_BUTTON, JOYCON_EMIT_STICK) \
+        return ev - events; \
+    } \
+    \
+    static void joycon_merge_##kind(ControllerState *into, const ControllerState *state) { \
+        MAP(JOYCON_SKIP_BUTTON, JOYCON_MERGE_STICK) \
+        into->buttons = (into->buttons & ~(uint32_t)(mask)) | (state->buttons & (mask)); \
+    } \
+    \
+    const JoyconDecoder joycon_decoder_##kind = { \
+        #kind, (type), joycon_emit_##kind, joycon_merge_##kind \
+    };
+
+JOYCON_DEFINE_DECODER(left, 0x1, JOYCON_STATE_BUTTONS_LEFT, JOYCON_MAP_LEFT)
+JOYCON_DEFINE_DECODER(right, 0x2, JOYCON_STATE_BUTTONS_RIGHT, JOYCON_MAP_RIGHT)
+JOYCON_DEFINE_DECODER(pro, 0x3, JOYCON_STATE_BUTTONS_LEFT | JOYCON_STATE_BUTTONS_RIGHT, JOYCON_MAP_PRO)
+
+/**
+ * Picks the decoder for a controller. half only matters for the
+ * charging grip, where each half is a handle of its own.
+ */
+const JoyconDecoder *joycon_decoder_for(unsigned short product_id, int half) {
+    switch(product_id) {
+        case JOYCON_L_BT:
+            return &joycon_decoder_left;
+        case JOYCON_R_BT:
+            return &joycon_decoder_right;
+        case PRO_CONTROLLER:
+            return &joycon_decoder_pro;
+        case JOYCON_CHARGING_GRIP:
+            return half == JOYCON_HALF_LEFT ? &joycon_decoder_left : &joycon_decoder_right;
+        default:
+            return NULL;
+    }
+}
\ No newline at end of file
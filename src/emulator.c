@@ -0,0 +1,507 @@
+/**
+*** :: emulator.c ::
+***
+***   Answers output reports the way the controller firmware does, as
+***   far as Wyatt (and most other hosts) ever gets to see it:
+***
+***     - the 0x80 USB commands of the charging grip / Pro Controller,
+***       including the 0x92 wrapper everything else rides in over USB
+***     - subcommands: device info, report mode, IMU, vibration, player
+***       lights, voltage, and SPI flash reads, writes and erases
+***     - standard input reports (0x30 / 0x31), streamed every period
+***       over Bluetooth and handed out per 0x1F request over USB
+***
+***   The MCU (IR camera, NFC) and the 0x3F simple HID mode aren't
+***   emulated. MCU subcommands get NACKed, and until the host picks a
+***   report mode a Bluetooth controller simply stays quiet.
+***
+***   What's in the input reports comes from a script, which can be a
+***   capture (hex_dump lines, as printed by the poll loop) played back
+***   one report per line, or "hold" lines describing a state and how
+***   long to keep it:
+***
+***     # ms  buttons   lx   ly   rx   ry
+***     hold 500 0x000008 2048 2048 2048 2048
+***
+**/
+
+#include "emulator.h"
+#include "hexline.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Where the stick and IMU data sits inside EmulatorFrame.input. */
+#define EMULATOR_STICKS (3)
+#define EMULATOR_IMU (10)
+
+/* Resting flat, 1G at the default +-8G range. */
+#define EMULATOR_ACCEL_1G (4096)
+
+static void emulator_pack_stick(uint8_t *out, uint16_t x, uint16_t y) {
+    out[0] = x & 0xFF;
+    out[1] = (x >> 8) | ((y & 0x0F) << 4);
+    out[2] = y >> 4;
+}
+
+static void emulator_put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+/**
+ * Turns a decoded state into the raw bytes of a script frame,
+ * with the controller lying still on a table.
+ */
+static void emulator_pack_frame(uint8_t *input, const ControllerState *state) {
+    memset(input, 0, EMULATOR_FRAME_SIZE);
+    input[0] = state->buttons & 0xFF;
+    input[1] = (state->buttons >> 8) & 0xFF;
+    input[2] = (state->buttons >> 16) & 0xFF;
+    emulator_pack_stick(&input[EMULATOR_STICKS], state->stick_l[0], state->stick_l[1]);
+    emulator_pack_stick(&input[EMULATOR_STICKS + 3], state->stick_r[0], state->stick_r[1]);
+    
+    for(int i = 0; i < 3; i++) {
+        emulator_put_u16(&input[EMULATOR_IMU + i * 12 + 4], EMULATOR_ACCEL_1G);
+    }
+}
+
+/**
+ * What a factory fresh controller has in its SPI flash, or at
+ * least the parts hosts go looking for: serial number, device
+ * type, stick and IMU calibration, and colours.
+ */
+static void emulator_default_flash(Emulator *em, int index) {
+    static const uint8_t colours[3][6] = {
+        {0x0A, 0xB9, 0xE6, 0x00, 0x1E, 0x1E},
+        {0xFF, 0x3C, 0x28, 0x1E, 0x0A, 0x0A},
+        {0x32, 0x32, 0x32, 0xFF, 0xFF, 0xFF},
+    };
+    uint8_t *flash = em->flash;
+    
+    memset(flash, 0xFF, EMULATOR_FLASH_SIZE);
+    
+    flash[0x6000] = 0x00;
+    flash[0x6001] = 0x00;
+    snprintf((char*)&flash[0x6002], 15, "XEW%011d", index);
+    
+    flash[0x6012] = em->kind;
+    
+    // Factory IMU calibration, accel then gyro: origin, then sensitivity
+    for(int i = 0; i < 3; i++) {
+        emulator_put_u16(&flash[0x6020 + i * 2], 0);
+        emulator_put_u16(&flash[0x6026 + i * 2], 0x4000);
+        emulator_put_u16(&flash[0x602C + i * 2], 0);
+        emulator_put_u16(&flash[0x6032 + i * 2], 0x343B);
+    }
+    
+    // Factory stick calibration. Left is above/center/below, right is center/below/above
+    emulator_pack_stick(&flash[0x603D], 0x600, 0x600);
+    emulator_pack_stick(&flash[0x6040], 0x800, 0x800);
+    emulator_pack_stick(&flash[0x6043], 0x600, 0x600);
+    emulator_pack_stick(&flash[0x6046], 0x800, 0x800);
+    emulator_pack_stick(&flash[0x6049], 0x600, 0x600);
+    emulator_pack_stick(&flash[0x604C], 0x600, 0x600);
+    
+    memcpy(&flash[0x6050], colours[em->kind - 1], 6);
+}
+
+/**
+ * Sets up a controller of the given kind. Wired controllers talk the
+ * USB protocol of the charging grip, everything else Bluetooth.
+ * Without a flash image (a dump made by spi_flash_dump) the flash
+ * gets made up; index keeps MACs and serials apart between instances.
+ */
+int emulator_init(Emulator *em, EmulatorKind kind, bool wired, int index, const char *flash_path) {
+    ControllerState neutral = {0, {0x800, 0x800}, {0x800, 0x800}};
+    
+    memset(em, 0, sizeof(Emulator));
+    em->kind = kind;
+    em->wired = wired;
+    em->period_us = EMULATOR_DEFAULT_PERIOD_US;
+    em->report_mode = wired ? 0x30 : 0x3F;
+    
+    em->mac[0] = 0x98;
+    em->mac[1] = 0xB6;
+    em->mac[2] = 0xE9;
+    em->mac[3] = kind;
+    em->mac[4] = (index >> 8) & 0xFF;
+    em->mac[5] = index & 0xFF;
+    
+    em->flash = (uint8_t*)malloc(EMULATOR_FLASH_SIZE);
+    if(em->flash == NULL) return -1;
+    
+    emulator_default_flash(em, index);
+    if(flash_path) {
+        FILE *dump = fopen(flash_path, "rb");
+        if(dump == NULL) {
+            printf("Failed to open flash image %s\n", flash_path);
+            emulator_free(em);
+            return -1;
+        }
+        
+        // Whatever the dump doesn't cover stays erased
+        memset(em->flash, 0xFF, EMULATOR_FLASH_SIZE);
+        fread(em->flash, 1, EMULATOR_FLASH_SIZE, dump);
+        fclose(dump);
+    }
+    
+    emulator_pack_frame(em->input, &neutral);
+    return 0;
+}
+
+/**
+ * Plays the script from its first frame on, looping forever.
+ * The script has to outlive the emulator.
+ */
+void emulator_attach_script(Emulator *em, const EmulatorScript *script, uint64_t now_us) {
+    em->script = script && script->num_frames ? script : NULL;
+    em->script_frame = 0;
+    em->script_frame_us = now_us;
+}
+
+/**
+ * Moves the script along to whatever the report being built
+ * right now should carry.
+ */
+static void emulator_advance(Emulator *em, uint64_t now_us) {
+    const EmulatorScript *script = em->script;
+    if(script == NULL) return;
+    
+    const EmulatorFrame *frame = &script->frames[em->script_frame];
+    while(frame->hold_us && now_us - em->script_frame_us >= frame->hold_us) {
+        em->script_frame_us += frame->hold_us;
+        em->script_frame = (em->script_frame + 1) % script->num_frames;
+        frame = &script->frames[em->script_frame];
+    }
+    
+    memcpy(em->input, frame->input, EMULATOR_FRAME_SIZE);
+    
+    // Captured frames only last for the one report
+    if(!frame->hold_us) {
+        em->script_frame = (em->script_frame + 1) % script->num_frames;
+        em->script_frame_us = now_us;
+    }
+}
+
+/**
+ * Fills in the 13 bytes every input report starts with.
+ * Each controller only reports the buttons and stick it has.
+ */
+static void emulator_report_header(Emulator *em, uint8_t *report, uint8_t id) {
+    uint32_t buttons = em->input[0] | (em->input[1] << 8) | (em->input[2] << 16);
+    uint32_t mask = 0;
+    
+    if(em->kind & EMULATOR_JOYCON_L) mask |= JOYCON_STATE_BUTTONS_LEFT;
+    if(em->kind & EMULATOR_JOYCON_R) mask |= JOYCON_STATE_BUTTONS_RIGHT;
+    buttons &= mask;
+    
+    report[0] = id;
+    report[1] = em->timer++;
+    report[2] = em->wired ? 0x8E : 0x80; // Full battery, charging when wired
+    report[3] = buttons & 0xFF;
+    report[4] = (buttons >> 8) & 0xFF;
+    report[5] = (buttons >> 16) & 0xFF;
+    
+    if(em->kind & EMULATOR_JOYCON_L)
+        memcpy(&report[6], &em->input[EMULATOR_STICKS], 3);
+    if(em->kind & EMULATOR_JOYCON_R)
+        memcpy(&report[9], &em->input[EMULATOR_STICKS + 3], 3);
+    
+    report[12] = em->input[9];
+}
+
+/**
+ * Builds a standard input report in the current report mode.
+ */
+static int emulator_input_report(Emulator *em, uint8_t *report, uint64_t now_us) {
+    uint8_t id = em->report_mode == 0x31 ? 0x31 : 0x30;
+    
+    emulator_advance(em, now_us);
+    emulator_report_header(em, report, id);
+    if(em->imu_enabled)
+        memcpy(&report[13], &em->input[EMULATOR_IMU], 36);
+    
+    em->reports_sent++;
+    if(id == 0x31) {
+        // No MCU, so no MCU data either
+        report[49] = 0xFF;
+        return 362;
+    }
+    
+    return 49;
+}
+
+/**
+ * Answers a subcommand with a 0x21 report: the usual header,
+ * then the ack byte, the subcommand id and its reply data.
+ */
+static int emulator_subcommand(Emulator *em, uint8_t subcommand, const uint8_t *args, int len, uint8_t *reply) {
+    uint8_t *data = &reply[15];
+    uint8_t ack = 0x80;
+    uint32_t addr = len >= 4 ? args[0] | (args[1] << 8) | (args[2] << 16) | ((uint32_t)args[3] << 24) : 0;
+    uint8_t size = len >= 5 ? args[4] : 0;
+    
+    emulator_report_header(em, reply, 0x21);
+    
+    switch(subcommand) {
+        case 0x02: // Device info
+            ack = 0x82;
+            data[0] = 0x03; // Firmware 3.89
+            data[1] = 0x89;
+            data[2] = em->kind;
+            data[3] = 0x02;
+            memcpy(&data[4], em->mac, 6);
+            data[10] = 0x01;
+            data[11] = 0x01; // Colours are in SPI
+            break;
+        case 0x03: // Set report mode
+            if(len >= 1)
+                em->report_mode = args[0];
+            break;
+        case 0x04: // Trigger buttons elapsed time
+            ack = 0x83;
+            break;
+        case 0x08: // Shipment low power state
+            break;
+        case 0x10: // SPI flash read
+            if(len < 5 || size > 0x1D || addr >= EMULATOR_FLASH_SIZE) {
+                ack = 0x00;
+                break;
+            }
+            ack = 0x90;
+            memcpy(data, args, 5);
+            
+            // spi_flash_dump's last read runs past the end, that part reads as erased
+            memset(&data[5], 0xFF, size);
+            memcpy(&data[5], &em->flash[addr], addr + size > EMULATOR_FLASH_SIZE ? EMULATOR_FLASH_SIZE - addr : size);
+            break;
+        case 0x11: // SPI flash write
+            if(len < 5 || size > 0x1D || len < 5 + size || addr + size > EMULATOR_FLASH_SIZE) {
+                ack = 0x00;
+                break;
+            }
+            memcpy(&em->flash[addr], &args[5], size);
+            data[0] = 0x00; // Success
+            break;
+        case 0x12: // SPI sector erase
+            if(len < 4 || addr >= EMULATOR_FLASH_SIZE) {
+                ack = 0x00;
+                break;
+            }
+            memset(&em->flash[addr & ~0xFFFu], 0xFF, 0x1000);
+            data[0] = 0x00;
+            break;
+        case 0x30: // Set player lights
+            if(len >= 1)
+                em->player_lights = args[0];
+            break;
+        case 0x31: // Get player lights
+            ack = 0xB0;
+            data[0] = em->player_lights;
+            break;
+        case 0x38: // HOME light
+        case 0x41: // IMU sensitivity
+            break;
+        case 0x40: // Enable IMU
+            em->imu_enabled = len >= 1 && args[0];
+            break;
+        case 0x48: // Enable vibration
+            em->vibration_enabled = len >= 1 && args[0];
+            break;
+        case 0x50: // Battery voltage, 1630 * 2.5mV
+            ack = 0xD0;
+            emulator_put_u16(data, 1630);
+            break;
+        default:
+            ack = 0x00;
+            break;
+    }
+    
+    reply[13] = ack;
+    reply[14] = subcommand;
+    em->subcommands_answered++;
+    
+    return 49;
+}
+
+/**
+ * Handles a report the way the controller's UART side sees it,
+ * starting at its command byte (0x01, 0x10, 0x11 or 0x1F).
+ */
+static int emulator_uart(Emulator *em, const uint8_t *data, int len, uint8_t *reply, uint64_t now_us) {
+    switch(data[0]) {
+        case 0x01: // Rumble and subcommand
+            if(len < 11) return 0;
+            return emulator_subcommand(em, data[10], &data[11], len - 11, reply);
+        case 0x1F: // Just the input please
+            return emulator_input_report(em, reply, now_us);
+        default:   // Rumble only, or MCU
+            return 0;
+    }
+}
+
+/**
+ * Handles the 0x80 commands of the USB side, other than 0x92.
+ */
+static int emulator_usb_command(Emulator *em, uint8_t command, uint8_t *reply) {
+    reply[0] = 0x81;
+    reply[1] = command;
+    
+    switch(command) {
+        case 0x01: // Status and MAC, backwards
+            reply[2] = 0x00;
+            reply[3] = em->kind;
+            for(int i = 0; i < 6; i++) {
+                reply[4 + i] = em->mac[5 - i];
+            }
+            return 10;
+        case 0x02: // Handshake
+        case 0x03: // Baudrate
+        case 0x04: // HID only
+        case 0x05: // Back to Bluetooth
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Feeds an output report, as the host wrote it, into the controller.
+ * Returns the length of the input report it answers with and leaves it
+ * in reply, which must hold EMULATOR_MAX_REPORT bytes. Returns 0 when
+ * the controller has nothing to say.
+ */
+int emulator_output(Emulator *em, const uint8_t *data, int len, uint8_t *reply, uint64_t now_us) {
+    int res;
+    
+    if(len < 1) return 0;
+    memset(reply, 0, EMULATOR_MAX_REPORT);
+    
+    if(!em->wired)
+        return emulator_uart(em, data, len, reply, now_us);
+    
+    if(len < 2 || data[0] != 0x80) return 0;
+    
+    if(data[1] != 0x92)
+        res = emulator_usb_command(em, data[1], reply);
+    else if(len > 8 && (res = emulator_uart(em, &data[8], len - 8, &reply[10], now_us)) > 0) {
+        // Everything from the UART side comes back wrapped the same way it went in
+        reply[0] = 0x81;
+        reply[1] = 0x92;
+        reply[4] = (res >> 8) & 0xFF;
+        reply[5] = res & 0xFF;
+        res += 10;
+    }
+    else
+        return 0;
+    
+    // USB reports are always a full packet
+    return res > 0 && res < 0x40 ? 0x40 : res;
+}
+
+/**
+ * Produces the next streamed input report once it's due. Only
+ * Bluetooth controllers stream, over USB they wait to be asked.
+ */
+int emulator_poll(Emulator *em, uint8_t *report, uint64_t now_us) {
+    if(em->wired || (em->report_mode != 0x30 && em->report_mode != 0x31))
+        return 0;
+    
+    if(now_us < em->next_report_us)
+        return 0;
+    
+    // Don't try to catch up on reports we were too late for
+    em->next_report_us += em->period_us;
+    if(em->next_report_us <= now_us)
+        em->next_report_us = now_us + em->period_us;
+    
+    memset(report, 0, EMULATOR_MAX_REPORT);
+    return emulator_input_report(em, report, now_us);
+}
+
+void emulator_free(Emulator *em) {
+    free(em->flash);
+    em->flash = NULL;
+}
+
+/**
+ * Reads a script or capture. Captures may come from Bluetooth or
+ * USB, the 0x81 0x92 header gives away which. Lines that aren't
+ * an input report or a hold line are skipped.
+ */
+int emulator_script_load(EmulatorScript *script, const char *path) {
+    static char line[0x2000];
+    uint8_t report[0x400];
+    int capacity = 0;
+    
+    memset(script, 0, sizeof(EmulatorScript));
+    
+    FILE *in = fopen(path, "r");
+    if(in == NULL) {
+        printf("Failed to open script %s\n", path);
+        return -1;
+    }
+    
+    while(fgets(line, sizeof(line), in)) {
+        EmulatorFrame frame;
+        ControllerState state;
+        unsigned int hold_ms, buttons, lx, ly, rx, ry;
+        
+        if(line[0] == '#') continue;
+        
+        if(sscanf(line, " hold %u %x %u %u %u %u", &hold_ms, &buttons, &lx, &ly, &rx, &ry) == 6) {
+            state.buttons = buttons;
+            state.stick_l[0] = lx & 0xFFF;
+            state.stick_l[1] = ly & 0xFFF;
+            state.stick_r[0] = rx & 0xFFF;
+            state.stick_r[1] = ry & 0xFFF;
+            emulator_pack_frame(frame.input, &state);
+            frame.hold_us = hold_ms * 1000;
+            
+            // A hold of 0ms would be a one report frame, make it the shortest real one instead
+            if(!frame.hold_us)
+                frame.hold_us = 1;
+        }
+        else {
+            int len = hexline_parse(line, report, sizeof(report));
+            int offset = len >= 2 && report[0] == 0x81 && report[1] == 0x92 ? 0xA : 0;
+            
+            if(len < offset + 49) continue;
+            if(report[offset] != 0x30 && report[offset] != 0x31) continue;
+            
+            memcpy(frame.input, &report[offset + 3], EMULATOR_FRAME_SIZE);
+            frame.hold_us = 0;
+        }
+        
+        if(script->num_frames == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            EmulatorFrame *frames = (EmulatorFrame*)realloc(script->frames, capacity * sizeof(EmulatorFrame));
+            if(frames == NULL) {
+                fclose(in);
+                emulator_script_free(script);
+                return -1;
+            }
+            script->frames = frames;
+        }
+        script->frames[script->num_frames++] = frame;
+    }
+    
+    fclose(in);
+    
+    if(!script->num_frames) {
+        printf("No frames in script %s\n", path);
+        return -1;
+    }
+    
+    return 0;
+}
+
+void emulator_script_free(EmulatorScript *script) {
+    free(script->frames);
+    script->frames = NULL;
+    script->num_frames = 0;
+}
\ No newline at end of file
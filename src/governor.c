@@ -0,0 +1,149 @@
+/**
+*** :: governor.c ::
+***
+***   Over USB the controllers only ever speak when spoken to, so the
+***   poll loop used to ask them for input as fast as it could spin,
+***   burning a whole core even with nobody touching anything.
+***
+***   The governor watches the decoded state of every device. Once
+***   none of them has changed for a while it drops into idle mode and
+***   only lets the loop ask for input at a low rate. The first report
+***   that shows any change puts it right back into active mode, and
+***   the very next request goes out immediately.
+***
+***   It also keeps track of how much CPU the process has been using,
+***   so the effect can be seen from the outside. SIGUSR1 prints that
+***   and the current mode, along with the trace counters.
+***
+**/
+
+#include "governor.h"
+#include "wengine.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t governor_cpu_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Sets up the governor in active mode.
+ * An active period of 0 means no limit at all.
+ */
+void governor_init(Governor *governor, uint64_t active_period_us, uint64_t idle_period_us, uint64_t idle_after_us) {
+    memset(governor, 0, sizeof(Governor));
+    governor->mode = GOVERNOR_ACTIVE;
+    governor->active_period_us = active_period_us;
+    governor->idle_period_us = idle_period_us;
+    governor->idle_after_us = idle_after_us;
+    governor->cpu_window_wall_us = wengine_now_us();
+    governor->cpu_window_cpu_us = governor_cpu_us();
+}
+
+/**
+ * Checks a fresh state of one device against the last one that counted
+ * as a change. Any button, or a stick moving past the noise floor,
+ * wakes the governor up on the spot.
+ */
+void governor_observe(Governor *governor, int device, const ControllerState *state, uint64_t now_us) {
+    if(device < 0 || device >= GOVERNOR_MAX_DEVICES) return;
+    
+    GovernorDevice *dev = &governor->devices[device];
+    bool changed = !dev->valid || state->buttons != dev->reference.buttons;
+    
+    for(int i = 0; i < 2 && !changed; i++) {
+        changed |= abs(state->stick_l[i] - dev->reference.stick_l[i]) > GOVERNOR_STICK_NOISE;
+        changed |= abs(state->stick_r[i] - dev->reference.stick_r[i]) > GOVERNOR_STICK_NOISE;
+    }
+    
+    if(!changed) return;
+    
+    dev->valid = true;
+    dev->reference = *state;
+    dev->last_change_us = now_us;
+    
+    if(governor->mode == GOVERNOR_IDLE) {
+        governor->mode = GOVERNOR_ACTIVE;
+        governor->next_poll_us = now_us;
+        printf("Governor: input, back to full rate\n");
+    }
+}
+
+/**
+ * Sleeps until the governor allows the next request for input.
+ */
+void governor_wait(Governor *governor) {
+    uint64_t now_us = wengine_now_us();
+    if(governor->next_poll_us <= now_us) return;
+    
+    struct timespec ts;
+    ts.tv_sec = governor->next_poll_us / 1000000;
+    ts.tv_nsec = (governor->next_poll_us % 1000000) * 1000;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/**
+ * To be called once a request for input went out. Schedules the
+ * next one, drops into idle mode if everyone's been quiet for long
+ * enough, and updates the CPU load figure.
+ */
+void governor_polled(Governor *governor, uint64_t now_us) {
+    governor->polls++;
+    
+    if(governor->mode == GOVERNOR_ACTIVE) {
+        // Nobody having reported anything yet doesn't count as quiet
+        bool quiet = false;
+        for(int i = 0; i < GOVERNOR_MAX_DEVICES; i++) {
+            GovernorDevice *dev = &governor->devices[i];
+            if(!dev->valid) continue;
+            
+            quiet = true;
+            if(now_us - dev->last_change_us < governor->idle_after_us) {
+                quiet = false;
+                break;
+            }
+        }
+        
+        if(quiet) {
+            governor->mode = GOVERNOR_IDLE;
+            printf("Governor: idle, polling every %llums (%.1f%% CPU while active)\n",
+                (unsigned long long)governor->idle_period_us / 1000, governor->cpu_load * 100.0);
+        }
+    }
+    
+    if(governor->mode == GOVERNOR_IDLE) {
+        governor->idle_polls++;
+        governor->next_poll_us = now_us + governor->idle_period_us;
+    }
+    else {
+        governor->next_poll_us = now_us + governor->active_period_us;
+    }
+    
+    uint64_t wall_us = now_us - governor->cpu_window_wall_us;
+    if(wall_us >= GOVERNOR_CPU_WINDOW_US) {
+        uint64_t cpu_us = governor_cpu_us();
+        governor->cpu_load = (double)(cpu_us - governor->cpu_window_cpu_us) / wall_us;
+        governor->cpu_window_wall_us = now_us;
+        governor->cpu_window_cpu_us = cpu_us;
+    }
+}
+
+const char *governor_mode_name(const Governor *governor) {
+    return governor->mode == GOVERNOR_IDLE ? "idle" : "active";
+}
+
+/**
+ * Prints the current mode and what the loop costs, on request.
+ */
+void governor_dump(const Governor *governor) {
+    printf("%-16s %s  cpu %.1f%%  polls %llu  idle polls %llu\n", "governor",
+        governor_mode_name(governor), governor->cpu_load * 100.0,
+        (unsigned long long)governor->polls, (unsigned long long)governor->idle_polls);
+}
\ No newline at end of file
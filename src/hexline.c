@@ -0,0 +1,35 @@
+/**
+*** :: hexline.c ::
+***
+***   A DEBUG run logs every report as a line of hex bytes, possibly
+***   behind a "XXms delay," prefix. Captures get replayed by both the
+***   emulator and the IR replay tool, so the parsing lives here.
+***
+**/
+
+#include "hexline.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+/**
+ * Parses a line of hex bytes, skipping anything in front of a comma.
+ * Returns how many bytes went into out, at most max.
+ */
+int hexline_parse(const char *line, uint8_t *out, int max) {
+    const char *p = strrchr(line, ',');
+    int len = 0;
+    
+    p = p ? p + 1 : line;
+    while(len < max) {
+        while(*p && isspace((unsigned char)*p)) p++;
+        if(!isxdigit((unsigned char)p[0]) || !isxdigit((unsigned char)p[1])) break;
+        
+        out[len++] = (uint8_t)strtoul((char[]){p[0], p[1], '\0'}, NULL, 16);
+        p += 2;
+    }
+    
+    return len;
+}
\ No newline at end of file
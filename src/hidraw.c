@@ -0,0 +1,389 @@
+/**
+*** :: hidraw.c ::
+***
+***   hidapi costs us a syscall for every hid_read and hid_write, plus
+***   a couple of fcntl()s every time hid_set_nonblocking flips a
+***   handle around, and the poll loop does all of that per device,
+***   per frame. Add controllers and the syscall count goes up with them.
+***
+***   This transport opens the same /dev/hidrawN nodes hidapi found and
+***   keeps a few reads in flight on each of them through io_uring, on
+***   buffers registered with the ring up front. Every frame, the writes
+***   for all devices and the reads that need rearming go out with one
+***   io_uring_enter(), and completions are picked up straight from the
+***   shared completion ring without any syscall at all. So no matter how
+***   many controllers are attached, a frame costs one syscall.
+***
+***   Where io_uring isn't available (old kernel, seccomp, sysctl) it
+***   falls back to plain nonblocking read()/write().
+***
+**/
+
+#include "hidraw.h"
+#include "wengine.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Tags for the user_data of every submission. */
+#define HIDRAW_TAG(device, slot, write) (((uint64_t)(device) << 8) | ((slot) << 1) | (write))
+#define HIDRAW_TAG_DEVICE(tag) ((int)((tag) >> 8))
+#define HIDRAW_TAG_SLOT(tag) ((int)(((tag) >> 1) & 0x7F))
+#define HIDRAW_TAG_WRITE(tag) ((int)((tag) & 1))
+
+/* Registered buffers of one device: its read slots, then its write buffer. */
+#define HIDRAW_BUFFERS_PER_DEVICE (HIDRAW_READ_SLOTS + 1)
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Creates the ring and maps its submission and completion queues.
+ * Returns 0 on success, -1 if io_uring can't be used here.
+ */
+static int hidraw_ring_setup(HidrawTransport *transport) {
+    struct io_uring_params params;
+    
+    memset(&params, 0, sizeof(params));
+    transport->ring_fd = sys_io_uring_setup(HIDRAW_RING_ENTRIES, &params);
+    if(transport->ring_fd < 0) return -1;
+    
+    transport->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    transport->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    transport->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    
+    // Newer kernels map both queues in one go
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(transport->cq_ring_size > transport->sq_ring_size)
+            transport->sq_ring_size = transport->cq_ring_size;
+        transport->cq_ring_size = transport->sq_ring_size;
+    }
+    
+    transport->sq_ring = mmap(NULL, transport->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, transport->ring_fd, IORING_OFF_SQ_RING);
+    if(transport->sq_ring == MAP_FAILED) goto fail;
+    
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        transport->cq_ring = transport->sq_ring;
+    }
+    else {
+        transport->cq_ring = mmap(NULL, transport->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, transport->ring_fd, IORING_OFF_CQ_RING);
+        if(transport->cq_ring == MAP_FAILED) goto fail;
+    }
+    
+    transport->sqes = mmap(NULL, transport->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, transport->ring_fd, IORING_OFF_SQES);
+    if(transport->sqes == MAP_FAILED) goto fail;
+    
+    uint8_t *sq = transport->sq_ring;
+    uint8_t *cq = transport->cq_ring;
+    transport->sq_head = (unsigned*)(sq + params.sq_off.head);
+    transport->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    transport->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    transport->sq_array = (unsigned*)(sq + params.sq_off.array);
+    transport->cq_head = (unsigned*)(cq + params.cq_off.head);
+    transport->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    transport->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    transport->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    
+    return 0;
+    
+fail:
+    if(transport->cq_ring && transport->cq_ring != MAP_FAILED && transport->cq_ring != transport->sq_ring)
+        munmap(transport->cq_ring, transport->cq_ring_size);
+    if(transport->sq_ring && transport->sq_ring != MAP_FAILED)
+        munmap(transport->sq_ring, transport->sq_ring_size);
+    close(transport->ring_fd);
+    transport->ring_fd = -1;
+    return -1;
+}
+
+/**
+ * Unmaps the queues and closes the ring. Anything still in flight is canceled.
+ */
+static void hidraw_ring_teardown(HidrawTransport *transport) {
+    if(transport->ring_fd < 0) return;
+    
+    close(transport->ring_fd);
+    munmap(transport->sqes, transport->sqes_size);
+    if(transport->cq_ring != transport->sq_ring)
+        munmap(transport->cq_ring, transport->cq_ring_size);
+    munmap(transport->sq_ring, transport->sq_ring_size);
+    transport->ring_fd = -1;
+    transport->uring = false;
+}
+
+/**
+ * Errors that mean the device is gone, rather than just a hiccup.
+ */
+static bool hidraw_fatal(int error) {
+    return error == ENODEV || error == EIO || error == EBADF || error == ESHUTDOWN;
+}
+
+/**
+ * Queues up one fixed-buffer read or write. It only goes out
+ * with the next io_uring_enter.
+ */
+static void hidraw_ring_queue(HidrawTransport *transport, int device, int slot, bool write) {
+    HidrawDevice *dev = &transport->devices[device];
+    unsigned tail = *transport->sq_tail;
+    unsigned index = tail & *transport->sq_mask;
+    struct io_uring_sqe *sqe = &transport->sqes[index];
+    
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = device;
+    sqe->addr = (uint64_t)(uintptr_t)(write ? dev->write_buf : dev->read_buf[slot]);
+    sqe->len = write ? dev->write_len : HIDRAW_REPORT_SIZE;
+    sqe->buf_index = device * HIDRAW_BUFFERS_PER_DEVICE + (write ? HIDRAW_READ_SLOTS : slot);
+    sqe->user_data = HIDRAW_TAG(device, slot, write);
+    
+    transport->sq_array[index] = index;
+    __atomic_store_n(transport->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    transport->sq_pending++;
+}
+
+/**
+ * Picks up every completion the kernel has posted so far,
+ * straight from the shared ring.
+ */
+static void hidraw_ring_reap(HidrawTransport *transport) {
+    unsigned head = *transport->cq_head;
+    unsigned tail = __atomic_load_n(transport->cq_tail, __ATOMIC_ACQUIRE);
+    
+    while(head != tail) {
+        struct io_uring_cqe *cqe = &transport->cqes[head & *transport->cq_mask];
+        int device = HIDRAW_TAG_DEVICE(cqe->user_data);
+        int slot = HIDRAW_TAG_SLOT(cqe->user_data);
+        HidrawDevice *dev = &transport->devices[device];
+        
+        if(cqe->res < 0) {
+            dev->error = -cqe->res;
+        }
+        
+        if(HIDRAW_TAG_WRITE(cqe->user_data)) {
+            dev->write_in_flight = false;
+        }
+        else if(cqe->res > 0) {
+            dev->read_len[slot] = cqe->res;
+            dev->read_state[slot] = HIDRAW_SLOT_READY;
+            dev->ready[(dev->ready_head + dev->ready_count++) % HIDRAW_READ_SLOTS] = slot;
+        }
+        else {
+            // Nothing to hand out, just arm it again
+            dev->read_state[slot] = HIDRAW_SLOT_IDLE;
+        }
+        
+        head++;
+    }
+    
+    __atomic_store_n(transport->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Opens the given hidraw nodes. Device i of the transport is paths[i].
+ * Returns 0 on success, -1 if any of them can't be opened.
+ */
+int hidraw_open(HidrawTransport *transport, const char **paths, int count) {
+    struct iovec iov[HIDRAW_MAX_DEVICES * HIDRAW_BUFFERS_PER_DEVICE];
+    int fds[HIDRAW_MAX_DEVICES];
+    size_t stride = HIDRAW_READ_SLOTS * HIDRAW_REPORT_SIZE + HIDRAW_WRITE_SIZE;
+    
+    memset(transport, 0, sizeof(HidrawTransport));
+    transport->ring_fd = -1;
+    
+    if(count <= 0 || count > HIDRAW_MAX_DEVICES) return -1;
+    
+    transport->uring = wengine_env_long("WYATT_HIDRAW_NO_URING", 0) == 0
+        && hidraw_ring_setup(transport) == 0;
+    
+    if(posix_memalign((void**)&transport->buffers, 4096, stride * count)) {
+        transport->buffers = NULL;
+        hidraw_ring_teardown(transport);
+        return -1;
+    }
+    memset(transport->buffers, 0, stride * count);
+    
+    for(int i = 0; i < count; i++) {
+        HidrawDevice *dev = &transport->devices[i];
+        uint8_t *base = transport->buffers + i * stride;
+        
+        // io_uring polls for us, so reads can stay blocking there
+        dev->fd = open(paths[i], O_RDWR | O_CLOEXEC | (transport->uring ? 0 : O_NONBLOCK));
+        if(dev->fd < 0) {
+            printf("Failed to open %s: %s\n", paths[i], strerror(errno));
+            transport->num_devices = i;
+            hidraw_close(transport);
+            return -1;
+        }
+        fds[i] = dev->fd;
+        
+        for(int slot = 0; slot < HIDRAW_READ_SLOTS; slot++) {
+            dev->read_buf[slot] = base + slot * HIDRAW_REPORT_SIZE;
+            iov[i * HIDRAW_BUFFERS_PER_DEVICE + slot].iov_base = dev->read_buf[slot];
+            iov[i * HIDRAW_BUFFERS_PER_DEVICE + slot].iov_len = HIDRAW_REPORT_SIZE;
+        }
+        dev->write_buf = base + HIDRAW_READ_SLOTS * HIDRAW_REPORT_SIZE;
+        iov[i * HIDRAW_BUFFERS_PER_DEVICE + HIDRAW_READ_SLOTS].iov_base = dev->write_buf;
+        iov[i * HIDRAW_BUFFERS_PER_DEVICE + HIDRAW_READ_SLOTS].iov_len = HIDRAW_WRITE_SIZE;
+    }
+    transport->num_devices = count;
+    
+    if(transport->uring) {
+        if(sys_io_uring_register(transport->ring_fd, IORING_REGISTER_BUFFERS, iov, count * HIDRAW_BUFFERS_PER_DEVICE)
+            || sys_io_uring_register(transport->ring_fd, IORING_REGISTER_FILES, fds, count)) {
+            printf("Failed to register hidraw buffers with io_uring, falling back to read/write\n");
+            
+            // The fds were opened blocking for io_uring, fix that up
+            for(int i = 0; i < count; i++) {
+                fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+            }
+            
+            hidraw_ring_teardown(transport);
+        }
+    }
+    
+    printf("Talking hidraw directly to %d device(s) %s\n", count,
+        transport->uring ? "through io_uring" : "with plain read/write");
+    
+    return 0;
+}
+
+/**
+ * Queues a report to go out with the next hidraw_submit.
+ * In fallback mode it's written right away.
+ * If the previous write is still in flight this one is dropped and counted.
+ * Returns -1 on error, including one a previous write ran into in the ring.
+ */
+int hidraw_write(HidrawTransport *transport, int device, const uint8_t *data, int len) {
+    if(device < 0 || device >= transport->num_devices || len > HIDRAW_WRITE_SIZE) return -1;
+    
+    HidrawDevice *dev = &transport->devices[device];
+    
+    if(!transport->uring) {
+        transport->syscalls++;
+        return write(dev->fd, data, len) < 0 ? -1 : 0;
+    }
+    
+    if(hidraw_fatal(dev->error)) return -1;
+    
+    if(dev->write_in_flight || dev->write_queued) {
+        transport->writes_dropped++;
+        return 0;
+    }
+    
+    memcpy(dev->write_buf, data, len);
+    dev->write_len = len;
+    dev->write_queued = true;
+    
+    return 0;
+}
+
+/**
+ * Sends off every queued write, and rearms every read slot that's
+ * been consumed, all with a single syscall. Doesn't wait for anything.
+ * Returns -1 if the ring refused them.
+ */
+int hidraw_submit(HidrawTransport *transport) {
+    if(!transport->uring) return 0;
+    
+    transport->frames++;
+    hidraw_ring_reap(transport);
+    
+    for(int i = 0; i < transport->num_devices; i++) {
+        HidrawDevice *dev = &transport->devices[i];
+        
+        // Rearming a device that's gone would only fail again right away, forever
+        if(hidraw_fatal(dev->error)) continue;
+        
+        if(dev->write_queued) {
+            hidraw_ring_queue(transport, i, 0, true);
+            dev->write_queued = false;
+            dev->write_in_flight = true;
+        }
+        
+        for(int slot = 0; slot < HIDRAW_READ_SLOTS; slot++) {
+            if(dev->read_state[slot] != HIDRAW_SLOT_IDLE) continue;
+            
+            hidraw_ring_queue(transport, i, slot, false);
+            dev->read_state[slot] = HIDRAW_SLOT_IN_FLIGHT;
+        }
+    }
+    
+    if(transport->sq_pending == 0) return 0;
+    
+    transport->syscalls++;
+    int res = sys_io_uring_enter(transport->ring_fd, transport->sq_pending, 0, 0);
+    if(res < 0) return -1;
+    
+    transport->sq_pending -= res;
+    return 0;
+}
+
+/**
+ * Hands out the next report the device has sent, if any.
+ * Returns its length, 0 if there's nothing new, -1 on error,
+ * same as hid_read in nonblocking mode.
+ */
+int hidraw_read(HidrawTransport *transport, int device, uint8_t *data, int len) {
+    if(device < 0 || device >= transport->num_devices) return -1;
+    
+    HidrawDevice *dev = &transport->devices[device];
+    
+    if(!transport->uring) {
+        transport->syscalls++;
+        int res = read(dev->fd, data, len);
+        if(res < 0) return (errno == EAGAIN) ? 0 : -1;
+        return res;
+    }
+    
+    if(dev->ready_count == 0) {
+        hidraw_ring_reap(transport);
+        if(dev->ready_count == 0) return hidraw_fatal(dev->error) ? -1 : 0;
+    }
+    
+    int slot = dev->ready[dev->ready_head];
+    dev->ready_head = (dev->ready_head + 1) % HIDRAW_READ_SLOTS;
+    dev->ready_count--;
+    
+    int res = dev->read_len[slot] < len ? dev->read_len[slot] : len;
+    memcpy(data, dev->read_buf[slot], res);
+    
+    // Goes back into the kernel's hands with the next submit
+    dev->read_state[slot] = HIDRAW_SLOT_IDLE;
+    
+    return res;
+}
+
+void hidraw_close(HidrawTransport *transport) {
+    hidraw_ring_teardown(transport);
+    
+    for(int i = 0; i < transport->num_devices; i++) {
+        close(transport->devices[i].fd);
+    }
+    transport->num_devices = 0;
+    
+    free(transport->buffers);
+    transport->buffers = NULL;
+}
\ No newline at end of file
@@ -21,6 +21,15 @@
 **/
 
 #include "joycons.h"
+#include "wengine.h"
+#include "decoder.h"
+#include "combiner.h"
+#include "netstream.h"
+#include "mcu.h"
+#include "governor.h"
+#include "hidraw.h"
+#include "trace.h"
+#include "telemetry.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -38,10 +47,6 @@
 
 /* We don't like magic numbers around here >:( .*/
 #define INPUT_LOOP
-#define JOYCON_L_BT (0x2006)
-#define JOYCON_R_BT (0x2007)
-#define PRO_CONTROLLER (0x2009)
-#define JOYCON_CHARGING_GRIP (0x200e)
 
 /* Related towards the different components of a possible JC setup. */
 const unsigned short NUM_PRODUCT_IDS = 4;
@@ -51,86 +56,6 @@ bool disconnect = false;
 bool bluetooth = true;
 uint8_t global_count = 0;
 
-/**
- * Most names here are pretty self explanatory.
- * BTN_T(L/R)(1/2)
- * is referring to the left and right trigger
- * buttons. (1 and 2).
- * Also known as ZL and ZR buttons.
- * 
- *    * FOR SUPER DUPER CLARITY;
- *      BTN_TL1 -> [BTN_LEFT_TRIGGER == BTN_TL1]
- *      BTN_TL2 -> [BTN_LEFT_ZTRIGGER == BTN_TL2]
- *      BTN_TR1 -> [BTN_RIGHT_TRIGGER == BTN_TR1]
- *      BTN_TR2 -> [BTN_RIGHT_ZTRIGGER == BTN_TR2] 
- * 
- * The next four arrays, are an attempt at
- * abridging the usually 2 seperate joycons together
- * and having a funcitonal button and bitflag map,
- * accurately representing what a simese joycon twin would
- * look and act like. 
- * 
- * TODO: Perhaps I should remove the simese joke.
- *       Possibly a bit too dark...    
- */
-int joycon_bits_to_buttons_left[] = {
-    BTN_DPAD_DOWN,
-    BTN_DPAD_UP,
-    BTN_DPAD_RIGHT,
-    BTN_DPAD_LEFT,
-    -1,
-    -1,
-    BTN_TL,
-    BTN_TL2,
-};
-
-int joycon_bits_to_buttons_right[] = {
-    BTN_WEST,
-    BTN_NORTH,
-    BTN_EAST,
-    BTN_SOUTH,
-    -1,
-    -1,
-    BTN_TR,
-    BTN_TR2,
-};
-
-int joycon_bits_to_buttons_middle_left[] = {
-    BTN_SELECT,
-    -1,
-    -1,
-    BTN_THUMBL,
-    -1,
-    BTN_Z,
-    -1,
-    -1,
-};
-
-int joycon_bits_to_buttons_middle_right[] = {
-    -1,
-    BTN_START,
-    BTN_THUMBR,
-    -1,
-    BTN_MODE,
-    -1,
-    -1,
-    -1,
-};
-
-/**
- * Data structure of how an input packet
- * is constructed, before being sent off.
- */
-typedef struct input_packet {
-    uint8_t header[8];
-    uint8_t unk1[5];
-    uint8_t buttons_r;
-    uint8_t buttons_middle;
-    uint8_t buttons_l;
-    uint8_t sticks[6];
-} InputPacket;
-
-
 /**
  * FUNCTIONS
  */
@@ -152,6 +77,10 @@ void hex_dump(unsigned char *buf, int len) {
 void hid_exchange(hid_device *handle, unsigned char *buf, int len) {
     if(!handle) return;
     
+    int device = trace_lookup(handle);
+    TRACE_COUNT(device, exchanges);
+    TRACE(exchange_entry, device, buf[0]);
+    
 #ifdef DEBUG_PRINT
     hex_dump(buf, len);
 #endif
@@ -163,6 +92,7 @@ void hid_exchange(hid_device *handle, unsigned char *buf, int len) {
     if(res > 0)
         hex_dump(buf, res);
 #endif
+    TRACE(exchange_exit, device, res);
 }
 
 /**
@@ -237,6 +167,15 @@ void hid_dual_write(hid_device *handle_l, hid_device *handle_r, unsigned char *b
     }
 }
 
+/**
+ * Where the standard input report (starting at its report id)
+ * begins inside of what hid_read hands us. Over USB it's wrapped
+ * behind the 0x81 0x92 header, over Bluetooth it's the raw report.
+ */
+int joycon_report_offset(void) {
+    return bluetooth ? 0x0 : 0xA;
+}
+
 /**
  * Sends a command to a joycon.
  */
@@ -269,6 +208,10 @@ void joycon_send_subcommand(hid_device *handle, int command, int subcommand, uin
     unsigned char buf[0x400];
     memset(buf, 0, 0x400);
     
+    int device = trace_lookup(handle);
+    TRACE_COUNT(device, subcommands);
+    TRACE(subcommand, device, subcommand);
+    
     uint8_t rumble_base[9] = {(++global_count) & 0xF, 0x00, 0x01, 0x40, 0x40, 0x00, 0x01, 0x40, 0x40};
     memcpy(buf, rumble_base, 9);
     
@@ -307,6 +250,8 @@ void spi_write(hid_device *handle, uint32_t offs, uint8_t *data, uint8_t len) {
     do {
         //usleep(300000);
         write_count += 1;
+        if(write_count > 1)
+            TRACE_COUNT(trace_lookup(handle), retries);
         memcpy(buf, spi_write, 0x39);
         joycon_send_subcommand(handle, 0x1, 0x11, buf, 0x26);
     }
@@ -336,6 +281,8 @@ void spi_read(hid_device *handle, uint32_t offs, uint8_t *data, uint8_t len) {
     do {
         //usleep(300000);
 		read_count += 1;
+        if(read_count > 1)
+            TRACE_COUNT(trace_lookup(handle), retries);
         memcpy(buf, spi_read_cmd, 0x36);
         joycon_send_subcommand(handle, 0x1, 0x10, buf, 0x26);
     }
@@ -374,6 +321,8 @@ void spi_flash_dump(hid_device *handle, char *out_path) {
         int read_count = 0;
         while(1) {
             read_count += 1;
+            if(read_count > 1)
+                TRACE_COUNT(trace_lookup(handle), retries);
             memcpy(buf, spi_read_cmd, 0x26);
             joycon_send_subcommand(handle, 0x1, 0x10, buf, 0x26);
             
@@ -401,13 +350,18 @@ void spi_flash_dump(hid_device *handle, char *out_path) {
 }
 
 /**
- * Initializes a single joycon.
+ * Initializes a single joycon. trace_key tells its trace
+ * counters apart from those of any other controller.
  */
-int joycon_init(hid_device *handle, const wchar_t *name) {
+int joycon_init(hid_device *handle, const wchar_t *name, const char *trace_key) {
     unsigned char buf[0x400];
     unsigned char sn_buffer[14] = {0x00};
+    char trace_name[32];
     memset(buf, 0, 0x400);
     
+    // Everything sent from here on gets counted against this device
+    snprintf(trace_name, sizeof(trace_name), "%ls", name);
+    trace_register(handle, trace_key, trace_name);
     
     if(!bluetooth) {
         // Get MAC Left
@@ -505,88 +459,47 @@ void device_print(struct hid_device_info *dev) {
     printf("  Product:      %ls\n\n", dev->product_string);
 }
 
-void joycon_parse_input(int fd, unsigned char *data, int type) {
-    struct input_event ev;
-    struct input_packet *input = (struct input_packet*)data;
-    
-    //Left
-    if(type & 1) {
-        for(int i = 0; i < 8; i++) {
-            if(joycon_bits_to_buttons_left[i] < 0) continue;
-            
-            memset(&ev, 0, sizeof(struct input_event));
-            ev.type = EV_KEY;
-            ev.code = joycon_bits_to_buttons_left[i];
-            ev.value = (input->buttons_l & (1 << i)) ? 1 : 0;
-            write(fd, &ev, sizeof(struct input_event));
-        }
-        
-        for(int i = 0; i < 8; i++) {
-            if(joycon_bits_to_buttons_middle_left[i] < 0) continue;
-            
-            memset(&ev, 0, sizeof(struct input_event));
-            ev.type = EV_KEY;
-            ev.code = joycon_bits_to_buttons_middle_left[i];
-            ev.value = (input->buttons_middle & (1 << i)) ? 1 : 0;
-            write(fd, &ev, sizeof(struct input_event));
-        }
-        
-        int stick_x = ((input->sticks[1] & 0x0F) << 4) | ((input->sticks[0] & 0xF0) >> 4);
-        int stick_y = 256 - input->sticks[2];
-        
-        memset(&ev, 0, sizeof(struct input_event));
-        ev.type = EV_ABS;
-        ev.code = ABS_X;
-        ev.value = stick_x;
-        write(fd, &ev, sizeof(struct input_event));
-        
-        memset(&ev, 0, sizeof(struct input_event));
-        ev.type = EV_ABS;
-        ev.code = ABS_Y;
-        ev.value = stick_y;
-        write(fd, &ev, sizeof(struct input_event));
-    }
+/**
+ * What a controller's trace counters are kept under. Over Bluetooth
+ * the serial is its MAC and survives reconnects, over USB every
+ * controller has the same one, so the hidraw path has to do.
+ */
+static void joycon_trace_key(struct hid_device_info *dev, char *key, size_t len) {
+    if(dev->serial_number && dev->serial_number[0] && wcscmp(dev->serial_number, L"000000000001"))
+        snprintf(key, len, "%ls", dev->serial_number);
+    else
+        snprintf(key, len, "%s", dev->path);
+}
 
-    //Right
-    if(type & 2) {
+/**
+ * Whoever hears about combined frames besides uinput.
+ */
+typedef struct frame_sinks {
+    NetStream *stream;
+    Governor *governor;
+} FrameSinks;
 
-        for(int i = 0; i < 8; i++) {
-            if(joycon_bits_to_buttons_right[i] < 0) continue;
-            
-            memset(&ev, 0, sizeof(struct input_event));
-            ev.type = EV_KEY;
-            ev.code = joycon_bits_to_buttons_right[i];
-            ev.value = (input->buttons_r & (1 << i)) ? 1 : 0;
-            write(fd, &ev, sizeof(struct input_event));
-        }
-        
-        for(int i = 0; i < 8; i++) {
-            if(joycon_bits_to_buttons_middle_right[i] < 0) continue;
-            
-            memset(&ev, 0, sizeof(struct input_event));
-            ev.type = EV_KEY;
-            ev.code = joycon_bits_to_buttons_middle_right[i];
-            ev.value = (input->buttons_middle & (1 << i)) ? 1 : 0;
-            write(fd, &ev, sizeof(struct input_event));
-        }
-        
-        int stick_x = ((input->sticks[4] & 0x0F) << 4) | ((input->sticks[3] & 0xF0) >> 4);
-        int stick_y = 256 - input->sticks[5];
-        
-        memset(&ev, 0, sizeof(struct input_event));
-        ev.type = EV_ABS;
-        ev.code = ABS_RX;
-        ev.value = stick_x;
-        write(fd, &ev, sizeof(struct input_event));
-        
-        memset(&ev, 0, sizeof(struct input_event));
-        ev.type = EV_ABS;
-        ev.code = ABS_RY;
-        ev.value = stick_y;
-        write(fd, &ev, sizeof(struct input_event));
+/**
+ * Mirrors every frame uinput gets onto the state stream, and lets
+ * the governor know, whichever path flushed the frame.
+ */
+static void on_combined_frame(const FrameCombiner *combiner, uint64_t arrival_us, void *user) {
+    FrameSinks *sinks = (FrameSinks*)user;
+    
+    netstream_publish(sinks->stream, 0, &combiner->state, arrival_us);
+    for(int i = 0; i < combiner->num_sources; i++) {
+        governor_observe(sinks->governor, i, &combiner->sources[i].state, arrival_us);
     }
 }
 
+/**
+ * Hands completed IR camera images to the same stream
+ * the controller state goes out on.
+ */
+static void on_ir_frame(const McuFrame *frame, void *user) {
+    netstream_publish_image((NetStream*)user, 0, frame->number, frame->width, frame->height, frame->pixels);
+}
+
 /**
  * This will be moved into wengine.c as it will be the
  * API's entry point. But for now, I'll leave this here,
@@ -604,6 +517,27 @@ int main(void) {
     const wchar_t *device_name = L"none";
     struct hid_device_info *devs, *dev_iter;
     bool charging_grip = false;
+    bool emulated_grip = wengine_env_long("WYATT_EMULATED_GRIP", 0);
+    bool failed = false;
+    unsigned short product_r = 0;
+    FrameCombiner combiner;
+    int source_l = -1, source_r = -1;
+    NetStream stream;
+    const char *stream_spec = getenv("WYATT_STREAM");
+    Mcu mcu;
+    int ir_width = wengine_env_long("WYATT_IR", 0);
+    Governor governor;
+    FrameSinks sinks = {&stream, &governor};
+    StateStore store;
+    Motion motion;
+    const char *motion_mode = getenv("WYATT_MOTION");
+    Predictor predictor;
+    TelemetryRecorder telemetry;
+    const char *telemetry_dir = getenv("WYATT_TELEMETRY");
+    HidrawTransport hidraw;
+    int trace_l = TRACE_UNKNOWN_DEVICE, trace_r = TRACE_UNKNOWN_DEVICE;
+    char path_l[256] = {0}, path_r[256] = {0};
+    char trace_key[64];
 
     // Set up udev, get a path, open the file for ioctling
     udev = udev_new();
@@ -653,6 +587,25 @@ int main(void) {
     ioctl(fd, UI_SET_ABSBIT, ABS_Y);
     ioctl(fd, UI_SET_ABSBIT, ABS_RX);
     ioctl(fd, UI_SET_ABSBIT, ABS_RY);
+    
+    // Gyro aiming, as a pointer or on top of the right stick
+    MotionMode mode = MOTION_OFF;
+    if(motion_mode && !strcmp(motion_mode, "pointer"))
+        mode = MOTION_POINTER;
+    else if(motion_mode && !strcmp(motion_mode, "stick"))
+        mode = MOTION_STICK;
+    else if(motion_mode && motion_mode[0] && strcmp(motion_mode, "off"))
+        printf("Unknown WYATT_MOTION \"%s\", expected pointer, stick or off. Leaving it off...\n", motion_mode);
+    
+    motion_init(&motion, mode,
+        wengine_env_double("WYATT_MOTION_SENSITIVITY",
+            mode == MOTION_STICK ? MOTION_DEFAULT_STICK_SENSITIVITY : MOTION_DEFAULT_SENSITIVITY),
+        wengine_env_double("WYATT_MOTION_ACCELERATION", MOTION_DEFAULT_ACCELERATION),
+        wengine_env_double("WYATT_MOTION_SMOOTHING", MOTION_DEFAULT_SMOOTHING));
+    motion_setup(&motion, fd);
+    
+    // Every frame says when its samples were taken, not just when we wrote it
+    combiner_setup(fd);
 
     memset(&udevice, 0, sizeof(udevice));
     snprintf(udevice.name, UINPUT_MAX_NAME_SIZE, "joycon");
@@ -671,23 +624,63 @@ int main(void) {
     write(fd, &udevice, sizeof(udevice));
     ioctl(fd, UI_DEV_CREATE);
 
+    // Optionally mirror everything onto a datagram socket as well
+    stream.fd = -1;
+    if(stream_spec && netstream_open(&stream, stream_spec)) {
+        printf("Failed to open state stream, continuing without it...\n");
+    }
+    
+    // Hours of IMU and stick history for QA, written out in the background
+    memset(&telemetry, 0, sizeof(telemetry));
+    if(telemetry_dir && telemetry_open(&telemetry, telemetry_dir,
+        wengine_env_long("WYATT_TELEMETRY_ROTATE_S", TELEMETRY_DEFAULT_ROTATE_US / 1000000) * 1000000ULL)) {
+        printf("Failed to start telemetry, continuing without it...\n");
+    }
+    
+    // IR camera images need somewhere to go
+    memset(&mcu, 0, sizeof(mcu));
+    if(ir_width && mcu_init(&mcu, ir_width, on_ir_frame, &stream)) {
+        printf("Failed to set up IR camera, continuing without it...\n");
+        ir_width = 0;
+    }
+
+    memset(&hidraw, 0, sizeof(hidraw));
+    hidraw.ring_fd = -1;
+
     // Start talking HID
     res = hid_init();
     if(res) {
         printf("Failed to open hid library! Exiting...\n");
-        return -1;
+        failed = true;
+        goto cleanup;
     }
     
+    trace_init();
+    
 init_start:
     disconnect = false;
     charging_grip = false;
+    
+    // Only still holding handles when we came back here from the poll loop
+    if(handle_r) {
+        TRACE_COUNT(trace_lookup(handle_r), reconnects);
+        TRACE(reconnect, trace_lookup(handle_r), 0);
+    }
+    if(handle_l) {
+        TRACE_COUNT(trace_lookup(handle_l), reconnects);
+        TRACE(reconnect, trace_lookup(handle_l), 0);
+    }
+    
+    hidraw_close(&hidraw);
 
     if(handle_l) {
+        trace_unregister(handle_l);
         hid_close(handle_l);
         handle_l = 0;
     }
     
     if(handle_r) {
+        trace_unregister(handle_r);
         hid_close(handle_r);
         handle_r = 0;
     }
@@ -700,10 +693,15 @@ init_start:
             // Sometimes hid_enumerate still returns other product IDs
             if (dev_iter->product_id != PRODUCT_IDS[i]) break;
             
+            // Emulated grips (wyatt_uhid) have no USB interfaces, their product string names the half instead
+            int interface_number = dev_iter->interface_number;
+            if(emulated_grip && interface_number == -1 && dev_iter->product_id == JOYCON_CHARGING_GRIP)
+                interface_number = dev_iter->product_string && wcsstr(dev_iter->product_string, L"(L)") ? 1 : 0;
+            
             // break out if the current handle is already used
-            if((dev_iter->product_id == JOYCON_R_BT || dev_iter->interface_number == 0) && handle_r)
+            if((dev_iter->product_id == JOYCON_R_BT || interface_number == 0) && handle_r)
                 break;
-            else if((dev_iter->product_id == JOYCON_L_BT || dev_iter->interface_number == 1) && handle_l)
+            else if((dev_iter->product_id == JOYCON_L_BT || interface_number == 1) && handle_l)
                 break;
             
             device_print(dev_iter);
@@ -713,11 +711,13 @@ init_start:
             }
             else if(!bluetooth) {
                 printf("Can't mix USB HID with Bluetooth HID, exiting...\n");
-                return -1;
+                hid_free_enumeration(devs);
+                failed = true;
+                goto cleanup;
             }
             
             // on windows this will be -1 for devices with one interface
-            if(dev_iter->interface_number == 0 || dev_iter->interface_number == -1) {
+            if(interface_number == 0 || interface_number == -1) {
                 hid_device *handle = hid_open_path(dev_iter->path);
                 if(handle == NULL) {
                     printf("Failed to open controller at %ls, continuing...\n", dev_iter->path);
@@ -731,25 +731,34 @@ init_start:
                         charging_grip = true;
 
                         handle_r = handle;
+                        product_r = dev_iter->product_id;
+                        snprintf(path_r, sizeof(path_r), "%s", dev_iter->path);
                         break;
                     case PRO_CONTROLLER:
                         device_name = L"Pro Controller";
 
                         handle_r = handle;
+                        product_r = dev_iter->product_id;
+                        snprintf(path_r, sizeof(path_r), "%s", dev_iter->path);
                         break;
                     case JOYCON_L_BT:
                         device_name = L"Joy-Con (L)";
 
                         handle_l = handle;
+                        snprintf(path_l, sizeof(path_l), "%s", dev_iter->path);
                         break;
                     case JOYCON_R_BT:
                         device_name = L"Joy-Con (R)";
 
                         handle_r = handle;
+                        product_r = dev_iter->product_id;
+                        snprintf(path_r, sizeof(path_r), "%s", dev_iter->path);
                         break;
                 }
                 
-                if(joycon_init(handle, device_name)) {
+                joycon_trace_key(dev_iter, trace_key, sizeof(trace_key));
+                if(joycon_init(handle, device_name, trace_key)) {
+                    trace_unregister(handle);
                     hid_close(handle);
                     if(dev_iter->product_id != JOYCON_L_BT)
                         handle_r = NULL;
@@ -758,7 +767,7 @@ init_start:
                 }
             }
             // Only exists for left Joy-Con in the charging grip
-            else if(dev_iter->interface_number == 1) {
+            else if(interface_number == 1) {
                 handle_l = hid_open_path(dev_iter->path);
                 if(handle_l == NULL) {
                     printf("Failed to open controller at %ls, continuing...\n", dev_iter->path);
@@ -766,7 +775,9 @@ init_start:
                     continue;
                 }
                 
-                if(joycon_init(handle_l, L"Joy-Con (L)"))
+                snprintf(path_l, sizeof(path_l), "%s", dev_iter->path);
+                joycon_trace_key(dev_iter, trace_key, sizeof(trace_key));
+                if(joycon_init(handle_l, L"Joy-Con (L)", trace_key))
                     handle_l = NULL;
             }
             dev_iter = dev_iter->next;
@@ -776,22 +787,76 @@ init_start:
     
     if(!handle_r) {
         printf("Failed to get handle for right Joy-Con or Pro Controller, exiting...\n");
-        return -1;
+        failed = true;
+        goto cleanup;
     }
     
     // Only missing one half by this point
     if(!handle_l && charging_grip) {
         printf("Could not get handles for both Joy-Con in grip! Exiting...\n");
-        return -1;
+        failed = true;
+        goto cleanup;
+    }
+    
+    // Both halves feed one combiner, so uinput only ever sees whole frames
+    long deadline_us = wengine_env_long("WYATT_COMBINE_DEADLINE_US", COMBINER_DEFAULT_DEADLINE_US);
+    statestore_init(&store);
+    combiner_init(&combiner, fd, deadline_us < 0 ? 0 : deadline_us, &store, 0);
+    // Whatever is in the right hand decides how reports get decoded, only the grip splits it up
+    trace_r = trace_lookup(handle_r);
+    trace_l = trace_lookup(handle_l);
+    source_r = combiner_add_source(&combiner, joycon_decoder_for(product_r, JOYCON_HALF_RIGHT), trace_r);
+    source_l = handle_l ? combiner_add_source(&combiner, &joycon_decoder_left, trace_l) : -1;
+    if(motion.mode != MOTION_OFF) {
+        // The gyro that matters is the one in the right hand
+        combiner_attach_motion(&combiner, &motion, source_r);
+    }
+    if(wengine_env_long("WYATT_PREDICT", 0)) {
+        // Starts from scratch on every reconnect. Stick mode gyro already owns the right stick
+        predictor_init(&predictor,
+            motion.mode == MOTION_STICK ? PREDICTOR_AXIS_LEFT : PREDICTOR_AXIS_LEFT | PREDICTOR_AXIS_RIGHT,
+            wengine_env_long("WYATT_PREDICT_PERIOD_US", PREDICTOR_DEFAULT_PERIOD_US),
+            wengine_env_long("WYATT_PREDICT_HORIZON_US", PREDICTOR_DEFAULT_HORIZON_US),
+            wengine_env_double("WYATT_PREDICT_SMOOTHING", PREDICTOR_DEFAULT_SMOOTHING));
+        combiner_attach_predictor(&combiner, &predictor);
+    }
+    if(telemetry.running) {
+        combiner_attach_telemetry(&combiner, &telemetry);
+    }
+    combiner_on_frame(&combiner, on_combined_frame, &sinks);
+    
+    // Only the right Joy-Con has a camera, and it only streams in report mode 0x31
+    if(ir_width) {
+        if(!bluetooth)
+            printf("IR camera streaming needs Bluetooth, skipping...\n");
+        else if(mcu_start(&mcu, handle_r))
+            printf("Failed to start IR camera, continuing without it...\n");
+    }
+    
+    // Back off from asking for input while nobody is touching anything
+    governor_init(&governor,
+        wengine_env_long("WYATT_ACTIVE_PERIOD_US", 0),
+        wengine_env_long("WYATT_IDLE_PERIOD_US", GOVERNOR_DEFAULT_IDLE_PERIOD_US),
+        wengine_env_long("WYATT_IDLE_AFTER_US", GOVERNOR_DEFAULT_IDLE_AFTER_US));
+    
+    // Skip hidapi in the poll loop and batch all I/O through the hidraw nodes
+    if(wengine_env_long("WYATT_HIDRAW", 0)) {
+        const char *paths[2] = {path_r, path_l};
+        
+        if(strncmp(path_r, "/dev/hidraw", 11) || (handle_l && strncmp(path_l, "/dev/hidraw", 11)))
+            printf("hidapi isn't using the hidraw backend, staying with hidapi...\n");
+        else if(hidraw_open(&hidraw, paths, handle_l ? 2 : 1))
+            printf("Failed to open hidraw nodes, staying with hidapi...\n");
     }
     
     // controller init is complete at this point
     printf("Start input poll loop\n");
     
     struct timeval start, end;
-    struct input_event ev;
     
     while(1) {
+        governor_wait(&governor);
+        
         gettimeofday(&start, 0);
         buf[0][0] = 0x80; // 80     Do custom command
         buf[0][1] = 0x92; // 92     Post-handshake type command
@@ -803,43 +868,86 @@ init_start:
         if(buf[1]) {
             memcpy(buf[1], buf[0], 0x9);
         }
-        hid_dual_write(handle_l, handle_r, buf[1], buf[0], 0x9);
+        if(hidraw.num_devices) {
+            if(hidraw_write(&hidraw, 0, buf[0], 0x9))
+                disconnect = true;
+            if(handle_l && hidraw_write(&hidraw, 1, buf[1], 0x9))
+                disconnect = true;
+            if(hidraw_submit(&hidraw))
+                disconnect = true;
+        }
+        else {
+            hid_dual_write(handle_l, handle_r, buf[1], buf[0], 0x9);
+        }
+        governor_polled(&governor, wengine_now_us());
         
         // Try and read the right for any input packets
-        hid_set_nonblocking(handle_r, 1);
+        if(!hidraw.num_devices)
+            hid_set_nonblocking(handle_r, 1);
         do {
-            res = hid_read(handle_r, buf[0], 0x40);
-            if(res) {
-                switch(buf[0][5]) {
+            res = hidraw.num_devices ? hidraw_read(&hidraw, 0, buf[0], 0x400) : hid_read(handle_r, buf[0], 0x400);
+            if(res < 0 && hidraw.num_devices) {
+                disconnect = true;
+                res = 0;
+            }
+            if(res > 0) {
+                TRACE_COUNT(trace_r, reports);
+                TRACE(report, trace_r, buf[0][joycon_report_offset()]);
+            }
+            if(res > joycon_report_offset()) {
+                // USB wraps the report in a header, Bluetooth starts right at its id
+                unsigned char *report = buf[0] + joycon_report_offset();
+                int len = res - joycon_report_offset();
+                
+                switch(report[0]) {
+                    case 0x30:
                     case 0x31:
-                        joycon_parse_input(fd, buf[0], charging_grip ? 0x2 : 0x3); //TODO?
+                        combiner_push(&combiner, source_r, report, len, wengine_now_us());
                         gettimeofday(&end, 0);
                         uint64_t delta_ms = (end.tv_sec*1000LL + end.tv_usec/1000) - (start.tv_sec*1000LL + start.tv_usec/1000);
                         printf("%02llums delay,  ", delta_ms);
-                        hex_dump(buf[0], 0x40);
+                        // All of it, so a capture of this can be replayed through wyatt_ir_replay
+                        hex_dump(buf[0], res);
                         break;
                     
                     default:
                     break;
                 }
+                
+                // Camera fragments ride along behind the input data
+                if(mcu.streaming && mcu_feed(&mcu, report, len))
+                    mcu_ack(&mcu, handle_r);
             }
         }
         while(res);
-        hid_set_nonblocking(handle_r, 0);
+        if(!hidraw.num_devices)
+            hid_set_nonblocking(handle_r, 0);
         
         // Try and read the left for any input packets
         if(handle_l) {
-            hid_set_nonblocking(handle_l, 1);
+            if(!hidraw.num_devices)
+                hid_set_nonblocking(handle_l, 1);
             do {
-                res = hid_read(handle_l, buf[1], 0x40);
-                if(res) {
-                    switch(buf[1][5]) {
+                res = hidraw.num_devices ? hidraw_read(&hidraw, 1, buf[1], 0x400) : hid_read(handle_l, buf[1], 0x400);
+                if(res < 0 && hidraw.num_devices) {
+                    disconnect = true;
+                    res = 0;
+                }
+                if(res > 0) {
+                    TRACE_COUNT(trace_l, reports);
+                    TRACE(report, trace_l, buf[1][joycon_report_offset()]);
+                }
+                if(res > joycon_report_offset()) {
+                    unsigned char *report = buf[1] + joycon_report_offset();
+                    
+                    switch(report[0]) {
+                        case 0x30:
                         case 0x31:
-                            joycon_parse_input(fd, buf[1], 0x1); //TODO?
+                            combiner_push(&combiner, source_l, report, res - joycon_report_offset(), wengine_now_us());
                             gettimeofday(&end, 0);
                             uint64_t delta_ms = (end.tv_sec*1000LL + end.tv_usec/1000) - (start.tv_sec*1000LL + start.tv_usec/1000);
                             printf("%02llums delay,  ", delta_ms);
-                            hex_dump(buf[1], 0x40);
+                            hex_dump(buf[1], res);
                             break;
                         
                         default:
@@ -848,27 +956,35 @@ init_start:
                 }
             }
             while(res);
-            hid_set_nonblocking(handle_l, 0);
+            if(!hidraw.num_devices)
+                hid_set_nonblocking(handle_l, 0);
         }
         
         gettimeofday(&end, 0);
         
-        // Sync our input state
-        memset(&ev, 0, sizeof(struct input_event));
-        ev.type = EV_SYN;
-        ev.code = 0;
-        ev.value = 0;
-        write(fd, &ev, sizeof(struct input_event));
+        // Sync our input state, but only once a whole frame is in
+        uint64_t now_us = wengine_now_us();
+        combiner_poll(&combiner, now_us);
+        combiner_predict(&combiner, now_us);
+        netstream_service(&stream, now_us);
+        if(trace_service())
+            governor_dump(&governor);
         
-        if(disconnect) goto init_start;
+        if(disconnect) {
+            combiner_flush(&combiner);
+            goto init_start;
+        }
     }
 
+    // Everything after startup ends up here, so the telemetry thread always gets to finish writing
+cleanup:
     if(handle_l) {
         joycon_deinit(handle_l, L"Joy-Con (L)");
         hid_close(handle_l);
     }
     
     if(handle_r) {
+        mcu_stop(&mcu, handle_r);
         joycon_deinit(handle_r, device_name);
         hid_close(handle_r);
     }
@@ -876,9 +992,14 @@ init_start:
     // Finalize the hidapi library
     res = hid_exit();
 
+    hidraw_close(&hidraw);
+    mcu_free(&mcu);
+    netstream_close(&stream);
+    telemetry_close(&telemetry);
+
     // Finalize udev
     ioctl(fd, UI_DEV_DESTROY);
     close(fd);
 
-    return 0;
+    return failed ? -1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,414 @@
+/**
+*** :: mcu.c ::
+***
+***   The right Joy-Con carries an MCU that runs the IR camera and
+***   the NFC reader. Once the controller is in report mode 0x31, every
+***   input report has room for 313 bytes of MCU data behind the IMU
+***   samples, and while the camera is streaming that room is filled
+***   with 300 byte fragments of the current image.
+***
+***   Setting it up is a little dance of subcommand 0x21 (MCU config)
+***   and output report 0x11 (MCU request), each with its own CRC-8,
+***   after which every fragment has to be acked by number or the
+***   camera stops sending. The layout of all of this follows the
+***   community reverse engineering notes, nothing here is official.
+***
+***   Fragments are written straight into one of a few preallocated
+***   frame slots as they arrive. When a frame is complete, the slot
+***   itself is handed to the consumer, no further copies are made.
+***
+***   mcu_feed never talks to the controller, so recorded or mocked
+***   report streams can be pushed through it without any hardware.
+***
+**/
+
+#include "mcu.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MCU_MAX_TRIES (200)
+
+/* MCU report ids, found at MCU_REPORT_ID_OFFSET. */
+#define MCU_REPORT_EMPTY (0x00)
+#define MCU_REPORT_STATE (0x01)
+#define MCU_REPORT_IR_FRAGMENT (0x03)
+#define MCU_REPORT_NO_DATA (0xFF)
+
+/* MCU states, found at MCU_STATE_OFFSET of a state report. */
+#define MCU_STATE_STANDBY (0x01)
+#define MCU_STATE_IR (0x05)
+
+#define MCU_IR_MODE_IMAGE_TRANSFER (0x07)
+
+static const uint8_t mcu_rumble_base[8] = {0x00, 0x01, 0x40, 0x40, 0x00, 0x01, 0x40, 0x40};
+static uint8_t mcu_crc_table[256];
+static uint8_t mcu_count = 0;
+
+/**
+ * Camera resolutions, with the value of the resolution register
+ * and the number of fragments (minus one) an image takes.
+ */
+static const struct {
+    uint16_t width;
+    uint16_t height;
+    uint8_t reg;
+    uint8_t fragments;
+} mcu_resolutions[] = {
+    {320, 240, 0x00, 0xFF},
+    {160, 120, 0x50, 0x3F},
+    {80, 60, 0x64, 0x0F},
+    {40, 30, 0x69, 0x03},
+};
+
+/**
+ * The MCU checks its own CRC-8 (polynomial 0x07) on every config
+ * and request packet.
+ */
+static void mcu_crc_init(void) {
+    for(int i = 0; i < 256; i++) {
+        uint8_t crc = i;
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+        mcu_crc_table[i] = crc;
+    }
+}
+
+static uint8_t mcu_crc8(const uint8_t *data, int len) {
+    uint8_t crc = 0;
+    for(int i = 0; i < len; i++) {
+        crc = mcu_crc_table[crc ^ data[i]];
+    }
+    return crc;
+}
+
+/**
+ * Sends an 0x11 MCU request, wrapped for USB if need be.
+ * If reply isn't NULL, the next input report is read back into it,
+ * starting at its report id.
+ */
+static int mcu_request(hid_device *handle, uint8_t *payload, int len, uint8_t *reply) {
+    unsigned char buf[0x400];
+    int tx_offset = joycon_report_offset() ? 0x8 : 0x0;
+    
+    memset(buf, 0, 0x400);
+    if(tx_offset) {
+        buf[0x00] = 0x80;
+        buf[0x01] = 0x92;
+        buf[0x03] = 0x31;
+    }
+    
+    payload[0] = 0x11;
+    payload[1] = (++mcu_count) & 0xF;
+    memcpy(payload + 2, mcu_rumble_base, 8);
+    memcpy(buf + tx_offset, payload, len);
+    
+    if(hid_write(handle, buf, len + tx_offset) < 0) return -1;
+    if(reply == NULL) return 0;
+    
+    int res = hid_read_timeout(handle, buf, 0x400, 50);
+    if(res <= joycon_report_offset()) return -1;
+    
+    memcpy(reply, buf + joycon_report_offset(), res - joycon_report_offset());
+    return res - joycon_report_offset();
+}
+
+/**
+ * Polls the MCU until it reports being in the given state.
+ */
+static int mcu_wait_state(hid_device *handle, uint8_t state) {
+    uint8_t payload[0x31];
+    uint8_t reply[0x400];
+    
+    for(int tries = 0; tries < MCU_MAX_TRIES; tries++) {
+        memset(payload, 0, sizeof(payload));
+        payload[10] = 0x01; // Status request
+        
+        int res = mcu_request(handle, payload, sizeof(payload), reply);
+        if(res > MCU_STATE_OFFSET && reply[0] == 0x31
+            && reply[MCU_REPORT_ID_OFFSET] == MCU_REPORT_STATE
+            && reply[MCU_STATE_OFFSET] == state)
+            return 0;
+    }
+    
+    return -1;
+}
+
+/**
+ * Sends an MCU config subcommand (0x21) and waits for it to be acked.
+ * args is the 38 byte argument block, its CRC gets filled in here.
+ */
+static int mcu_config(hid_device *handle, uint8_t *args) {
+    unsigned char buf[0x400];
+    int offset = joycon_report_offset();
+    
+    args[37] = mcu_crc8(args + 1, 36);
+    
+    for(int tries = 0; tries < MCU_MAX_TRIES; tries++) {
+        memset(buf, 0, 0x400);
+        memcpy(buf, args, 38);
+        joycon_send_subcommand(handle, 0x1, 0x21, buf, 38);
+        
+        if(buf[offset] == 0x21 && buf[offset + 14] == 0x21)
+            return 0;
+    }
+    
+    return -1;
+}
+
+/**
+ * Prepares the frame slots for images of the given width.
+ * Supported widths are 320, 160, 80 and 40.
+ */
+int mcu_init(Mcu *mcu, int width, mcu_frame_callback on_frame, void *user) {
+    int res = -1;
+    
+    memset(mcu, 0, sizeof(Mcu));
+    for(int i = 0; i < (int)(sizeof(mcu_resolutions) / sizeof(mcu_resolutions[0])); i++) {
+        if(mcu_resolutions[i].width == width) {
+            res = i;
+            break;
+        }
+    }
+    
+    if(res < 0) {
+        printf("Unsupported IR resolution %d, use 320, 160, 80 or 40\n", width);
+        return -1;
+    }
+    
+    mcu_crc_init();
+    
+    mcu->width = mcu_resolutions[res].width;
+    mcu->height = mcu_resolutions[res].height;
+    mcu->resolution_reg = mcu_resolutions[res].reg;
+    mcu->num_fragments = mcu_resolutions[res].fragments;
+    mcu->missing = -1;
+    mcu->on_frame = on_frame;
+    mcu->user = user;
+    
+    mcu->storage = (uint8_t*)calloc(MCU_FRAME_SLOTS, MCU_MAX_FRAME_SIZE);
+    if(mcu->storage == NULL) return -1;
+    
+    for(int i = 0; i < MCU_FRAME_SLOTS; i++) {
+        mcu->frames[i].width = mcu->width;
+        mcu->frames[i].height = mcu->height;
+        mcu->frames[i].size = mcu->width * mcu->height;
+        mcu->frames[i].pixels = mcu->storage + i * MCU_MAX_FRAME_SIZE;
+    }
+    
+    return 0;
+}
+
+/**
+ * Wakes up the MCU, switches it into IR mode, configures the camera
+ * and asks for the first fragment. The controller has to be in report
+ * mode 0x31 already, which joycon_init takes care of over Bluetooth.
+ */
+int mcu_start(Mcu *mcu, hid_device *handle) {
+    uint8_t args[0x400];
+    
+    mcu->streaming = false;
+    
+    // Resume the MCU
+    memset(args, 0, 0x400);
+    args[0] = 0x01;
+    joycon_send_subcommand(handle, 0x1, 0x22, args, 1);
+    
+    if(mcu_wait_state(handle, MCU_STATE_STANDBY)) {
+        printf("MCU didn't wake up!\n");
+        return -1;
+    }
+    
+    // MCU into IR mode
+    memset(args, 0, 0x400);
+    args[0] = 0x21;
+    args[1] = 0x00;
+    args[2] = MCU_STATE_IR;
+    if(mcu_config(handle, args) || mcu_wait_state(handle, MCU_STATE_IR)) {
+        printf("MCU refused IR mode!\n");
+        return -1;
+    }
+    
+    // Image transfer, and how many fragments make up one image
+    memset(args, 0, 0x400);
+    args[0] = 0x23;
+    args[1] = 0x01;
+    args[2] = MCU_IR_MODE_IMAGE_TRANSFER;
+    args[3] = mcu->num_fragments;
+    args[4] = 0x00; // Required MCU firmware 5.18
+    args[5] = 0x05;
+    args[6] = 0x00;
+    args[7] = 0x18;
+    if(mcu_config(handle, args)) {
+        printf("Failed to set IR mode!\n");
+        return -1;
+    }
+    
+    // Camera registers, as page/register/value triplets
+    const uint8_t registers[][3] = {
+        {0x00, 0x2e, mcu->resolution_reg},
+        {0x01, 0x30, 0x60}, // Exposure, low and high byte
+        {0x01, 0x31, 0x02},
+        {0x01, 0x32, 0x00}, // Max exposure off
+        {0x00, 0x10, 0x00}, // All IR LEDs on
+        {0x00, 0x07, 0x01}, // Finalize
+    };
+    
+    memset(args, 0, 0x400);
+    args[0] = 0x23;
+    args[1] = 0x04;
+    args[2] = sizeof(registers) / sizeof(registers[0]);
+    memcpy(args + 3, registers, sizeof(registers));
+    if(mcu_config(handle, args)) {
+        printf("Failed to configure IR camera!\n");
+        return -1;
+    }
+    
+    mcu->streaming = true;
+    mcu->last_fragment = 0;
+    mcu->missing = -1;
+    memset(mcu->received, 0, sizeof(mcu->received));
+    
+    printf("IR camera streaming at %dx%d\n", mcu->width, mcu->height);
+    mcu_ack(mcu, handle);
+    
+    return 0;
+}
+
+/**
+ * Delivers the frame in the current slot, and moves on to the next one.
+ */
+static void mcu_complete_frame(Mcu *mcu) {
+    McuFrame *frame = &mcu->frames[mcu->slot];
+    frame->number = mcu->frame_number++;
+    
+    mcu->frames_completed++;
+    if(mcu->on_frame) {
+        mcu->on_frame(frame, mcu->user);
+    }
+    
+    mcu->slot = (mcu->slot + 1) % MCU_FRAME_SLOTS;
+}
+
+/**
+ * Feeds one input report, starting at its report id, to the MCU.
+ * Any image fragment in it is put in place, and completed frames are
+ * passed on to the frame callback.
+ * Returns 1 if a fragment was taken in, which the controller then
+ * waits to have acked, 0 otherwise.
+ */
+int mcu_feed(Mcu *mcu, const uint8_t *report, int len) {
+    if(len <= MCU_STATE_OFFSET || report[0] != 0x31) return 0;
+    
+    switch(report[MCU_REPORT_ID_OFFSET]) {
+        case MCU_REPORT_STATE:
+            mcu->state = report[MCU_STATE_OFFSET];
+            return 0;
+        
+        case MCU_REPORT_IR_FRAGMENT:
+            break;
+        
+        default:
+            return 0;
+    }
+    
+    if(len < MCU_REPORT_SIZE) return 0;
+    
+    uint8_t fragment = report[MCU_FRAGMENT_NUMBER_OFFSET];
+    if(fragment > mcu->num_fragments) return 0;
+    
+    // Wrapped around into the next image, drop whatever is left of this one
+    if(fragment < mcu->last_fragment && fragment != mcu->missing) {
+        bool started = false;
+        for(int i = 0; i < MCU_MAX_FRAGMENTS / 64; i++) {
+            started |= mcu->received[i] != 0;
+        }
+        
+        if(started) {
+            mcu->frames_dropped++;
+        }
+        memset(mcu->received, 0, sizeof(mcu->received));
+        mcu->missing = -1;
+        mcu->last_fragment = 0;
+    }
+    
+    // Skipped ahead, ask for the hole to be filled with the next ack
+    if(fragment > mcu->last_fragment + 1 && mcu->missing < 0) {
+        mcu->missing = mcu->last_fragment + 1;
+    }
+    else if(fragment == mcu->missing) {
+        mcu->missing = -1;
+    }
+    
+    McuFrame *frame = &mcu->frames[mcu->slot];
+    memcpy(frame->pixels + fragment * MCU_FRAGMENT_SIZE, report + MCU_FRAGMENT_OFFSET, MCU_FRAGMENT_SIZE);
+    mcu->received[fragment / 64] |= 1ULL << (fragment % 64);
+    
+    if(fragment > mcu->last_fragment) {
+        mcu->last_fragment = fragment;
+    }
+    
+    if(mcu->last_fragment == mcu->num_fragments) {
+        bool complete = true;
+        for(int i = 0; i <= mcu->num_fragments; i++) {
+            if(!(mcu->received[i / 64] & (1ULL << (i % 64)))) {
+                complete = false;
+                break;
+            }
+        }
+        
+        if(complete) {
+            mcu_complete_frame(mcu);
+            memset(mcu->received, 0, sizeof(mcu->received));
+            mcu->missing = -1;
+        }
+    }
+    
+    return 1;
+}
+
+/**
+ * Acks the last fragment we got, or asks again for one we missed.
+ */
+void mcu_ack(Mcu *mcu, hid_device *handle) {
+    uint8_t payload[0x31];
+    
+    if(!mcu->streaming) return;
+    
+    memset(payload, 0, sizeof(payload));
+    payload[10] = 0x03; // IR request
+    payload[11] = 0x00;
+    if(mcu->missing >= 0) {
+        payload[12] = 0x01;
+        payload[13] = mcu->missing;
+    }
+    payload[14] = mcu->last_fragment;
+    payload[47] = mcu_crc8(payload + 11, 36);
+    payload[48] = 0xFF;
+    
+    mcu_request(handle, payload, sizeof(payload), NULL);
+}
+
+/**
+ * Puts the MCU back to sleep.
+ */
+void mcu_stop(Mcu *mcu, hid_device *handle) {
+    uint8_t args[0x400];
+    
+    if(!mcu->streaming) return;
+    mcu->streaming = false;
+    
+    memset(args, 0, 0x400);
+    args[0] = 0x00; // Suspend
+    joycon_send_subcommand(handle, 0x1, 0x22, args, 1);
+}
+
+void mcu_free(Mcu *mcu) {
+    free(mcu->storage);
+    mcu->storage = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,187 @@
+/**
+*** :: motion.c ::
+***
+***   Every report carries three gyro samples, 5ms apart. Using just
+***   one of them per report throws away two thirds of the motion and
+***   quantizes what's left to the report rate, which is what makes
+***   gyro aiming feel mushy. Instead, every new sample is pushed through
+***   the sensitivity/acceleration/smoothing chain on its own and
+***   integrated, and the result goes out with the very frame the
+***   report belongs to.
+***
+***   Pointer mode turns the integrated angle into EV_REL counts,
+***   carrying the fractional remainder over so slow turns still move.
+***   Stick mode adds the angular velocity on top of the physical right
+***   stick, for games that only understand sticks.
+***
+***   Gyro drift is taken care of by slowly tracking the bias whenever
+***   the controller is sitting still.
+***
+**/
+
+#include "motion.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+
+/* Below this, the controller counts as lying still and the bias gets tracked. */
+#define MOTION_STILL_DPS (3.0)
+#define MOTION_BIAS_ALPHA (0.002)
+#define MOTION_SMOOTH_ALPHA (0.25)
+
+/* Same range the sticks are advertised with. */
+#define MOTION_STICK_MIN (32)
+#define MOTION_STICK_MAX (255 - 32)
+
+void motion_init(Motion *motion, MotionMode mode, double sensitivity, double acceleration, double smoothing) {
+    memset(motion, 0, sizeof(Motion));
+    motion->mode = mode;
+    motion->sensitivity = sensitivity;
+    motion->acceleration = acceleration;
+    motion->smoothing = smoothing;
+}
+
+/**
+ * Advertises what we'll be emitting. Has to happen before UI_DEV_CREATE.
+ * Stick mode reuses ABS_RX/ABS_RY, which are always there.
+ */
+void motion_setup(Motion *motion, int fd) {
+    if(motion->mode != MOTION_POINTER) return;
+    
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+}
+
+/**
+ * Runs one gyro sample through bias, acceleration and smoothing.
+ * Leaves the output velocity (units per second) in out.
+ */
+static void motion_sample(Motion *motion, const int16_t *raw, double *out) {
+    double rate[3];
+    bool still = true;
+    
+    for(int axis = 0; axis < 3; axis++) {
+        rate[axis] = (raw[axis] - motion->bias[axis]) * MOTION_DPS_PER_UNIT;
+        still &= fabs(rate[axis]) < MOTION_STILL_DPS;
+    }
+    
+    if(still) {
+        for(int axis = 0; axis < 3; axis++) {
+            motion->bias[axis] += (raw[axis] - motion->bias[axis]) * MOTION_BIAS_ALPHA;
+        }
+    }
+    
+    // Yaw moves the pointer sideways, pitch up and down
+    double yaw = -rate[2];
+    double pitch = -rate[1];
+    double speed = sqrt(yaw * yaw + pitch * pitch);
+    double gain = motion->sensitivity * (1.0 + motion->acceleration * speed / 100.0);
+    double velocity[2] = {yaw * gain, pitch * gain};
+    
+    // Tiered smoothing: tremor gets averaged away, deliberate motion passes straight through
+    double direct = 1.0;
+    if(motion->smoothing > 0) {
+        direct = (speed - motion->smoothing) / motion->smoothing;
+        direct = direct < 0 ? 0 : (direct > 1 ? 1 : direct);
+    }
+    
+    for(int i = 0; i < 2; i++) {
+        motion->smoothed[i] += (velocity[i] - motion->smoothed[i]) * MOTION_SMOOTH_ALPHA;
+        out[i] = direct * velocity[i] + (1.0 - direct) * motion->smoothed[i];
+    }
+}
+
+static int motion_clamp_stick(int value) {
+    if(value < MOTION_STICK_MIN) return MOTION_STICK_MIN;
+    if(value > MOTION_STICK_MAX) return MOTION_STICK_MAX;
+    return value;
+}
+
+/**
+ * Sets an axis in the frame so far, taking over the event the
+ * decoder already put there for it if there is one, so the
+ * frame never carries two values for the same axis.
+ */
+static void motion_set_axis(struct input_event *events, int *count, uint16_t code, int value) {
+    int i = 0;
+    while(i < *count && !(events[i].type == EV_ABS && events[i].code == code)) i++;
+    
+    if(i == *count) {
+        memset(&events[i], 0, sizeof(struct input_event));
+        events[i].type = EV_ABS;
+        events[i].code = code;
+        (*count)++;
+    }
+    events[i].value = value;
+}
+
+/**
+ * Integrates the gyro samples the device got since the last call
+ * and puts the resulting events into the frame, which holds count
+ * events so far. Adds at most MOTION_MAX_EVENTS of them, stick mode
+ * overwrites the right stick events already in the frame instead.
+ * sample_us is when the report was sampled, going by its timer.
+ * Returns how many events the frame holds now.
+ */
+int motion_emit(Motion *motion, struct input_event *events, int count, const StateStore *store, int device, uint64_t sample_us) {
+    double velocity[2], sum[2] = {0, 0};
+    int16_t raw[3];
+    
+    if(motion->mode == MOTION_OFF || device < 0 || device >= STATESTORE_MAX_DEVICES) return count;
+    
+    // Reports can come in faster than the IMU fills them, only take samples we haven't seen.
+    // Goes by the controller's own clock, when reports reached us jitters far too much
+    int samples = STATESTORE_IMU_SAMPLES;
+    if(motion->last_sample_us) {
+        samples = (sample_us - motion->last_sample_us + MOTION_SAMPLE_US / 2) / MOTION_SAMPLE_US;
+        if(samples < 1) samples = 1;
+        if(samples > STATESTORE_IMU_SAMPLES) samples = STATESTORE_IMU_SAMPLES;
+    }
+    motion->last_sample_us = sample_us;
+    
+    // Oldest first, the newest sample is the last one in the report
+    for(int sample = STATESTORE_IMU_SAMPLES - samples; sample < STATESTORE_IMU_SAMPLES; sample++) {
+        for(int axis = 0; axis < 3; axis++) {
+            raw[axis] = store->gyro[axis][sample][device];
+        }
+        
+        motion_sample(motion, raw, velocity);
+        for(int i = 0; i < 2; i++) {
+            sum[i] += velocity[i];
+        }
+    }
+    
+    if(motion->mode == MOTION_POINTER) {
+        const uint16_t codes[2] = {REL_X, REL_Y};
+        
+        for(int i = 0; i < 2; i++) {
+            motion->remainder[i] += sum[i] * MOTION_SAMPLE_US / 1000000.0;
+            
+            int delta = (int)motion->remainder[i];
+            if(delta == 0) continue;
+            motion->remainder[i] -= delta;
+            
+            memset(&events[count], 0, sizeof(struct input_event));
+            events[count].type = EV_REL;
+            events[count].code = codes[i];
+            events[count].value = delta;
+            count++;
+        }
+    }
+    else {
+        // On top of wherever the physical stick is, same scale the decoders send it out at
+        int stick_x = store->stick_rx[device] >> 4;
+        int stick_y = 256 - (store->stick_ry[device] >> 4);
+        
+        motion_set_axis(events, &count, ABS_RX, motion_clamp_stick(stick_x + (int)(sum[0] / samples)));
+        motion_set_axis(events, &count, ABS_RY, motion_clamp_stick(stick_y + (int)(sum[1] / samples)));
+    }
+    
+    return count;
+}
\ No newline at end of file
@@ -0,0 +1,612 @@
+/**
+*** :: netstream.c ::
+***
+***   uinput only gets controller state as far as the local input
+***   stack. Anything that lives on another host, or in a sandbox
+***   without access to /dev/uinput, gets it from here instead.
+***
+***   The sender binds a datagram socket and waits for receivers
+***   to say hello. Every receiver that has said hello recently gets
+***   a copy of every update, all of them sent with one sendmmsg().
+***   Updates are deltas against the previous packet of the same
+***   device, so a moving stick costs 9 bytes on the wire. Keyframes
+***   go out periodically and whenever someone new joins, and
+***   sequence numbers let a receiver notice it missed something.
+***
+***   Addresses are given as "udp:HOST:PORT" or "unix:PATH". Leaving
+***   HOST empty binds to loopback only, listening on other interfaces
+***   takes naming one (or 0.0.0.0 / :: for all of them) explicitly.
+***
+**/
+
+#define _GNU_SOURCE
+
+#include "netstream.h"
+#include "wengine.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/random.h>
+
+/**
+ * Resolves an address spec into a socket address. An empty
+ * host means loopback, for the sender just as for receivers.
+ * Returns the socket family, or -1 if the spec is bad.
+ */
+static int netstream_resolve(const char *spec, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    memset(addr, 0, sizeof(struct sockaddr_storage));
+    
+    if(!strncmp(spec, "unix:", 5)) {
+        struct sockaddr_un *un = (struct sockaddr_un*)addr;
+        if(strlen(spec + 5) >= sizeof(un->sun_path)) return -1;
+        
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, spec + 5);
+        *addr_len = sizeof(struct sockaddr_un);
+        return AF_UNIX;
+    }
+    
+    if(!strncmp(spec, "udp:", 4)) {
+        char host[256];
+        const char *port = strrchr(spec + 4, ':');
+        if(port == NULL || port - (spec + 4) >= (long)sizeof(host)) return -1;
+        
+        memcpy(host, spec + 4, port - (spec + 4));
+        host[port - (spec + 4)] = '\0';
+        
+        struct addrinfo hints, *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        
+        if(getaddrinfo(host[0] ? host : NULL, port + 1, &hints, &res) || res == NULL) return -1;
+        
+        memcpy(addr, res->ai_addr, res->ai_addrlen);
+        *addr_len = res->ai_addrlen;
+        int family = res->ai_family;
+        freeaddrinfo(res);
+        return family;
+    }
+    
+    return -1;
+}
+
+#define NETSTREAM_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static void netstream_sipround(uint64_t *v) {
+    v[0] += v[1]; v[1] = NETSTREAM_ROTL(v[1], 13); v[1] ^= v[0]; v[0] = NETSTREAM_ROTL(v[0], 32);
+    v[2] += v[3]; v[3] = NETSTREAM_ROTL(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = NETSTREAM_ROTL(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = NETSTREAM_ROTL(v[1], 17); v[1] ^= v[2]; v[2] = NETSTREAM_ROTL(v[2], 32);
+}
+
+/**
+ * SipHash-2-4 of data under the given key.
+ */
+static uint64_t netstream_siphash(const uint64_t *key, const uint8_t *data, size_t len) {
+    uint64_t v[4] = {
+        key[0] ^ 0x736f6d6570736575ULL, key[1] ^ 0x646f72616e646f6dULL,
+        key[0] ^ 0x6c7967656e657261ULL, key[1] ^ 0x7465646279746573ULL,
+    };
+    uint64_t m;
+    size_t i;
+    
+    for(i = 0; i + 8 <= len; i += 8) {
+        m = 0;
+        for(int b = 7; b >= 0; b--) m = (m << 8) | data[i + b];
+        v[3] ^= m;
+        netstream_sipround(v);
+        netstream_sipround(v);
+        v[0] ^= m;
+    }
+    
+    m = (uint64_t)len << 56;
+    for(int b = 0; i + b < len; b++) m |= (uint64_t)data[i + b] << (8 * b);
+    v[3] ^= m;
+    netstream_sipround(v);
+    netstream_sipround(v);
+    v[0] ^= m;
+    
+    v[2] ^= 0xFF;
+    for(int r = 0; r < 4; r++) netstream_sipround(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+/**
+ * The cookie a receiver at the given address has to echo, for the
+ * nonce it picked. Only the sender can work it out, and only that
+ * address ever gets to see it.
+ */
+static void netstream_cookie(const NetStream *ns, const struct sockaddr_storage *addr, socklen_t addr_len,
+    const uint8_t *nonce, uint8_t *cookie) {
+    uint8_t data[sizeof(struct sockaddr_storage) + NETSTREAM_NONCE_SIZE];
+    
+    memcpy(data, addr, addr_len);
+    memcpy(data + addr_len, nonce, NETSTREAM_NONCE_SIZE);
+    uint64_t hash = netstream_siphash(ns->secret, data, addr_len + NETSTREAM_NONCE_SIZE);
+    
+    for(int i = 0; i < NETSTREAM_COOKIE_SIZE; i++) {
+        cookie[i] = hash >> (8 * i);
+    }
+}
+
+/**
+ * Packs a 12 bit X/Y pair the same way the controller does.
+ */
+static uint8_t *netstream_put_stick(uint8_t *out, const uint16_t *stick) {
+    out[0] = stick[0] & 0xFF;
+    out[1] = ((stick[0] >> 8) & 0x0F) | ((stick[1] & 0x0F) << 4);
+    out[2] = (stick[1] >> 4) & 0xFF;
+    return out + 3;
+}
+
+static const uint8_t *netstream_get_stick(const uint8_t *in, uint16_t *stick) {
+    stick[0] = in[0] | ((in[1] & 0x0F) << 8);
+    stick[1] = (in[1] >> 4) | (in[2] << 4);
+    return in + 3;
+}
+
+/**
+ * Opens the sending side, bound to the given address.
+ * Returns 0 on success, -1 otherwise.
+ */
+int netstream_open(NetStream *ns, const char *spec) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    
+    memset(ns, 0, sizeof(NetStream));
+    ns->fd = -1;
+    ns->keyframe_interval = NETSTREAM_DEFAULT_KEYFRAME_INTERVAL;
+    ns->keyframe_period_us = NETSTREAM_DEFAULT_KEYFRAME_PERIOD_US;
+    
+    if(getrandom(ns->secret, sizeof(ns->secret), 0) != sizeof(ns->secret)) {
+        printf("Failed to get a stream secret: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    int family = netstream_resolve(spec, &addr, &addr_len);
+    if(family < 0) {
+        printf("Bad stream address %s, expected udp:HOST:PORT or unix:PATH\n", spec);
+        return -1;
+    }
+    
+    ns->fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(ns->fd < 0) {
+        printf("Failed to create stream socket: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    if(family == AF_UNIX) {
+        strcpy(ns->path, ((struct sockaddr_un*)&addr)->sun_path);
+        unlink(ns->path);
+    }
+    
+    if(bind(ns->fd, (struct sockaddr*)&addr, addr_len)) {
+        printf("Failed to bind stream socket to %s: %s\n", spec, strerror(errno));
+        close(ns->fd);
+        ns->fd = -1;
+        return -1;
+    }
+    
+    printf("Streaming controller state on %s\n", spec);
+    return 0;
+}
+
+/**
+ * Picks up hellos and goodbyes from receivers, and forgets the
+ * ones we haven't heard from in a while. Never blocks.
+ */
+void netstream_service(NetStream *ns, uint64_t now_us) {
+    uint8_t packet[NETSTREAM_MAX_PACKET];
+    struct sockaddr_storage from;
+    socklen_t from_len;
+    ssize_t len;
+    
+    if(ns->fd < 0) return;
+    
+    for(;;) {
+        from_len = sizeof(from);
+        len = recvfrom(ns->fd, packet, sizeof(packet), 0, (struct sockaddr*)&from, &from_len);
+        if(len < 0) break;
+        if(len < NETSTREAM_HELLO_SIZE || packet[0] != NETSTREAM_MAGIC) continue;
+        if(packet[1] != NETSTREAM_KIND_HELLO && packet[1] != NETSTREAM_KIND_BYE) continue;
+        
+        // Without the cookie, all anyone gets is one challenge no bigger than what they sent
+        uint8_t cookie[NETSTREAM_COOKIE_SIZE];
+        netstream_cookie(ns, &from, from_len, packet + 2, cookie);
+        if(memcmp(packet + 2 + NETSTREAM_NONCE_SIZE, cookie, NETSTREAM_COOKIE_SIZE)) {
+            if(packet[1] == NETSTREAM_KIND_HELLO) {
+                packet[1] = NETSTREAM_KIND_CHALLENGE;
+                memcpy(packet + 2 + NETSTREAM_NONCE_SIZE, cookie, NETSTREAM_COOKIE_SIZE);
+                sendto(ns->fd, packet, NETSTREAM_HELLO_SIZE, 0, (struct sockaddr*)&from, from_len);
+            }
+            continue;
+        }
+        
+        int index = -1;
+        for(int i = 0; i < ns->num_subscribers; i++) {
+            if(ns->subscribers[i].addr_len == from_len
+                && !memcmp(&ns->subscribers[i].addr, &from, from_len)) {
+                index = i;
+                break;
+            }
+        }
+        
+        if(packet[1] == NETSTREAM_KIND_BYE) {
+            if(index >= 0) {
+                ns->subscribers[index] = ns->subscribers[--ns->num_subscribers];
+            }
+            continue;
+        }
+        
+        if(index < 0) {
+            if(ns->num_subscribers >= NETSTREAM_MAX_SUBSCRIBERS) continue;
+            
+            index = ns->num_subscribers++;
+            memcpy(&ns->subscribers[index].addr, &from, from_len);
+            ns->subscribers[index].addr_len = from_len;
+            
+            // The newcomer knows nothing yet, everyone gets a keyframe
+            for(int i = 0; i < NETSTREAM_MAX_DEVICES; i++) {
+                ns->devices[i].force_keyframe = true;
+            }
+        }
+        ns->subscribers[index].last_seen_us = now_us;
+    }
+    
+    for(int i = 0; i < ns->num_subscribers; i++) {
+        if(now_us - ns->subscribers[i].last_seen_us > NETSTREAM_SUBSCRIBER_TIMEOUT_US) {
+            ns->subscribers[i--] = ns->subscribers[--ns->num_subscribers];
+        }
+    }
+}
+
+/**
+ * Sends the state of one device to every subscriber, as a delta if
+ * we can get away with it. Nothing is sent if nothing changed and no
+ * keyframe is due.
+ * Returns the size of the packet sent, 0 if there was nothing to send.
+ */
+int netstream_publish(NetStream *ns, int device, const ControllerState *state, uint64_t now_us) {
+    uint8_t packet[NETSTREAM_MAX_PACKET];
+    struct mmsghdr msgs[NETSTREAM_MAX_SUBSCRIBERS];
+    struct iovec iov;
+    
+    if(ns->fd < 0 || device < 0 || device >= NETSTREAM_MAX_DEVICES) return 0;
+    
+    NetStreamDevice *dev = &ns->devices[device];
+    bool keyframe = !dev->valid || dev->force_keyframe
+        || dev->since_keyframe >= ns->keyframe_interval
+        || now_us - dev->keyframe_us >= ns->keyframe_period_us;
+    
+    uint8_t mask = NETSTREAM_FIELDS_ALL;
+    if(!keyframe) {
+        mask = 0;
+        if(state->buttons != dev->last.buttons)
+            mask |= NETSTREAM_FIELD_BUTTONS;
+        if(memcmp(state->stick_l, dev->last.stick_l, sizeof(state->stick_l)))
+            mask |= NETSTREAM_FIELD_STICK_L;
+        if(memcmp(state->stick_r, dev->last.stick_r, sizeof(state->stick_r)))
+            mask |= NETSTREAM_FIELD_STICK_R;
+        
+        if(!mask) return 0;
+    }
+    
+    uint8_t *out = packet;
+    *out++ = NETSTREAM_MAGIC;
+    *out++ = keyframe ? NETSTREAM_KIND_KEYFRAME : NETSTREAM_KIND_DELTA;
+    *out++ = dev->seq & 0xFF;
+    *out++ = dev->seq >> 8;
+    *out++ = device;
+    *out++ = mask;
+    
+    if(mask & NETSTREAM_FIELD_BUTTONS) {
+        *out++ = state->buttons & 0xFF;
+        *out++ = (state->buttons >> 8) & 0xFF;
+        *out++ = (state->buttons >> 16) & 0xFF;
+    }
+    if(mask & NETSTREAM_FIELD_STICK_L)
+        out = netstream_put_stick(out, state->stick_l);
+    if(mask & NETSTREAM_FIELD_STICK_R)
+        out = netstream_put_stick(out, state->stick_r);
+    
+    dev->seq++;
+    dev->last = *state;
+    dev->valid = true;
+    if(keyframe) {
+        dev->force_keyframe = false;
+        dev->since_keyframe = 0;
+        dev->keyframe_us = now_us;
+    }
+    else {
+        dev->since_keyframe++;
+    }
+    
+    if(ns->num_subscribers == 0) return 0;
+    
+    iov.iov_base = packet;
+    iov.iov_len = out - packet;
+    
+    memset(msgs, 0, ns->num_subscribers * sizeof(struct mmsghdr));
+    for(int i = 0; i < ns->num_subscribers; i++) {
+        msgs[i].msg_hdr.msg_name = &ns->subscribers[i].addr;
+        msgs[i].msg_hdr.msg_namelen = ns->subscribers[i].addr_len;
+        msgs[i].msg_hdr.msg_iov = &iov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    
+    int sent = sendmmsg(ns->fd, msgs, ns->num_subscribers, 0);
+    if(sent > 0) {
+        ns->packets_sent += sent;
+        ns->bytes_sent += sent * iov.iov_len;
+    }
+    
+    return iov.iov_len;
+}
+
+/**
+ * Sends a whole camera image to every subscriber, cut into chunks
+ * that comfortably fit a datagram. The chunks point straight into
+ * the caller's pixels, nothing gets copied on the way out.
+ * Returns the number of chunks the image took.
+ */
+int netstream_publish_image(NetStream *ns, int device, uint16_t frame, uint16_t width, uint16_t height, const uint8_t *pixels) {
+    uint8_t headers[NETSTREAM_MAX_IMAGE_CHUNKS][NETSTREAM_IMAGE_HEADER];
+    struct iovec iov[NETSTREAM_MAX_IMAGE_CHUNKS][2];
+    struct mmsghdr msgs[NETSTREAM_MAX_IMAGE_CHUNKS];
+    uint32_t size = width * height;
+    
+    if(ns->fd < 0 || ns->num_subscribers == 0) return 0;
+    if(device < 0 || device >= NETSTREAM_MAX_DEVICES || size == 0 || size > NETSTREAM_MAX_IMAGE) return 0;
+    
+    int chunks = (size + NETSTREAM_IMAGE_CHUNK - 1) / NETSTREAM_IMAGE_CHUNK;
+    
+    memset(msgs, 0, chunks * sizeof(struct mmsghdr));
+    for(int i = 0; i < chunks; i++) {
+        uint8_t *header = headers[i];
+        uint32_t offset = i * NETSTREAM_IMAGE_CHUNK;
+        
+        header[0] = NETSTREAM_MAGIC;
+        header[1] = NETSTREAM_KIND_IMAGE;
+        header[2] = frame & 0xFF;
+        header[3] = frame >> 8;
+        header[4] = device;
+        header[5] = i;
+        header[6] = chunks;
+        header[7] = width & 0xFF;
+        header[8] = width >> 8;
+        header[9] = height & 0xFF;
+        header[10] = height >> 8;
+        
+        iov[i][0].iov_base = header;
+        iov[i][0].iov_len = NETSTREAM_IMAGE_HEADER;
+        iov[i][1].iov_base = (void*)(pixels + offset);
+        iov[i][1].iov_len = (size - offset < NETSTREAM_IMAGE_CHUNK) ? size - offset : NETSTREAM_IMAGE_CHUNK;
+        
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    
+    for(int s = 0; s < ns->num_subscribers; s++) {
+        for(int i = 0; i < chunks; i++) {
+            msgs[i].msg_hdr.msg_name = &ns->subscribers[s].addr;
+            msgs[i].msg_hdr.msg_namelen = ns->subscribers[s].addr_len;
+        }
+        
+        int sent = sendmmsg(ns->fd, msgs, chunks, 0);
+        for(int i = 0; i < sent; i++) {
+            ns->bytes_sent += iov[i][0].iov_len + iov[i][1].iov_len;
+        }
+        if(sent > 0) {
+            ns->packets_sent += sent;
+        }
+    }
+    
+    return chunks;
+}
+
+void netstream_close(NetStream *ns) {
+    if(ns->fd < 0) return;
+    
+    close(ns->fd);
+    ns->fd = -1;
+    
+    if(ns->path[0]) {
+        unlink(ns->path);
+    }
+}
+
+/**
+ * Sends a hello or goodbye to the sender, with whatever cookie we've got.
+ */
+static void netstream_receiver_send(NetStreamReceiver *rx, uint8_t kind) {
+    uint8_t packet[NETSTREAM_HELLO_SIZE] = {NETSTREAM_MAGIC, kind};
+    
+    memcpy(packet + 2, rx->nonce, NETSTREAM_NONCE_SIZE);
+    memcpy(packet + 2 + NETSTREAM_NONCE_SIZE, rx->cookie, NETSTREAM_COOKIE_SIZE);
+    sendto(rx->fd, packet, sizeof(packet), 0, (struct sockaddr*)&rx->server, rx->server_len);
+}
+
+/**
+ * Opens a receiver and registers it with the sender at the given address.
+ * Returns 0 on success, -1 otherwise.
+ */
+int netstream_subscribe(NetStreamReceiver *rx, const char *spec) {
+    memset(rx, 0, sizeof(NetStreamReceiver));
+    rx->fd = -1;
+    
+    int family = netstream_resolve(spec, &rx->server, &rx->server_len);
+    if(family < 0) return -1;
+    
+    rx->fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(rx->fd < 0) return -1;
+    
+    // Unix datagram sockets need a name to be answered, let the kernel pick one
+    if(family == AF_UNIX) {
+        sa_family_t autobind = AF_UNIX;
+        if(bind(rx->fd, (struct sockaddr*)&autobind, sizeof(autobind))) {
+            close(rx->fd);
+            rx->fd = -1;
+            return -1;
+        }
+    }
+    
+    if(getrandom(rx->nonce, sizeof(rx->nonce), 0) != sizeof(rx->nonce)) {
+        close(rx->fd);
+        rx->fd = -1;
+        return -1;
+    }
+    
+    rx->last_hello_us = wengine_now_us();
+    netstream_receiver_send(rx, NETSTREAM_KIND_HELLO);
+    
+    return 0;
+}
+
+/**
+ * Puts one chunk of a camera image in place.
+ * Returns the device once its image is complete, -1 until then.
+ */
+static int netstream_receive_image(NetStreamReceiver *rx, const uint8_t *packet, ssize_t len) {
+    NetStreamImage *image = &rx->image;
+    
+    if(len <= NETSTREAM_IMAGE_HEADER) return -1;
+    
+    uint16_t frame = packet[2] | (packet[3] << 8);
+    int device = packet[4];
+    uint8_t chunk = packet[5];
+    uint8_t chunks = packet[6];
+    uint16_t width = packet[7] | (packet[8] << 8);
+    uint16_t height = packet[9] | (packet[10] << 8);
+    uint32_t size = width * height;
+    uint32_t offset = chunk * NETSTREAM_IMAGE_CHUNK;
+    
+    if(chunks == 0 || chunks > NETSTREAM_MAX_IMAGE_CHUNKS || chunk >= chunks) return -1;
+    if(size > NETSTREAM_MAX_IMAGE || offset + (len - NETSTREAM_IMAGE_HEADER) > size) return -1;
+    
+    // First chunk of a new image, whatever we had is either done or lost
+    if(image->device != device || image->frame != frame || image->received == 0 || image->complete) {
+        image->complete = false;
+        image->device = device;
+        image->frame = frame;
+        image->width = width;
+        image->height = height;
+        image->chunks = chunks;
+        image->received = 0;
+    }
+    
+    memcpy(image->pixels + offset, packet + NETSTREAM_IMAGE_HEADER, len - NETSTREAM_IMAGE_HEADER);
+    image->received |= 1ULL << chunk;
+    
+    uint64_t all = (chunks == 64) ? ~0ULL : (1ULL << chunks) - 1;
+    if(image->received != all) return -1;
+    
+    image->complete = true;
+    return device;
+}
+
+/**
+ * Waits up to timeout_ms (-1 for forever) for one packet and applies it.
+ * Keeps our subscription alive along the way.
+ * Returns the device that was updated, or -1 if nothing usable came in.
+ * rx->last_kind tells whether it was its state or its camera image.
+ */
+int netstream_receive(NetStreamReceiver *rx, int timeout_ms) {
+    uint8_t packet[NETSTREAM_MAX_DATAGRAM];
+    struct pollfd pfd = {rx->fd, POLLIN, 0};
+    uint64_t now_us = wengine_now_us();
+    
+    if(now_us - rx->last_hello_us >= NETSTREAM_HELLO_PERIOD_US) {
+        rx->last_hello_us = now_us;
+        netstream_receiver_send(rx, NETSTREAM_KIND_HELLO);
+    }
+    
+    // Don't sleep past the next hello, or the sender will forget us
+    if(timeout_ms < 0 || timeout_ms > NETSTREAM_HELLO_PERIOD_US / 1000) {
+        timeout_ms = NETSTREAM_HELLO_PERIOD_US / 1000;
+    }
+    
+    if(poll(&pfd, 1, timeout_ms) <= 0) return -1;
+    
+    ssize_t len = recv(rx->fd, packet, sizeof(packet), 0);
+    if(len < 6 || packet[0] != NETSTREAM_MAGIC) return -1;
+    
+    uint8_t kind = packet[1];
+    
+    // The sender wants proof we're really here, answer right away
+    if(kind == NETSTREAM_KIND_CHALLENGE) {
+        if(len < NETSTREAM_HELLO_SIZE || memcmp(packet + 2, rx->nonce, NETSTREAM_NONCE_SIZE)) return -1;
+        
+        memcpy(rx->cookie, packet + 2 + NETSTREAM_NONCE_SIZE, NETSTREAM_COOKIE_SIZE);
+        rx->last_hello_us = now_us;
+        netstream_receiver_send(rx, NETSTREAM_KIND_HELLO);
+        return -1;
+    }
+    
+    rx->last_kind = kind;
+    
+    if(kind == NETSTREAM_KIND_IMAGE)
+        return netstream_receive_image(rx, packet, len);
+    
+    if(kind != NETSTREAM_KIND_DELTA && kind != NETSTREAM_KIND_KEYFRAME) return -1;
+    
+    uint16_t seq = packet[2] | (packet[3] << 8);
+    int device = packet[4];
+    uint8_t mask = packet[5];
+    if(device >= NETSTREAM_MAX_DEVICES) return -1;
+    
+    int needed = 6 + ((mask & NETSTREAM_FIELD_BUTTONS) ? 3 : 0)
+        + ((mask & NETSTREAM_FIELD_STICK_L) ? 3 : 0)
+        + ((mask & NETSTREAM_FIELD_STICK_R) ? 3 : 0);
+    if(len < needed) return -1;
+    
+    NetStreamRemoteDevice *dev = &rx->devices[device];
+    if(dev->seen) {
+        int16_t gap = (int16_t)(seq - dev->seq);
+        
+        // Duplicated or overtaken, we already have something newer.
+        // A keyframe from way back is the sender having restarted though
+        if(gap <= 0 && !(kind == NETSTREAM_KIND_KEYFRAME && gap < -NETSTREAM_RESTART_GAP)) return -1;
+        
+        if(gap > 1) {
+            dev->lost += gap - 1;
+            dev->synced = false;
+        }
+    }
+    dev->seen = true;
+    dev->seq = seq;
+    
+    // Deltas can't catch us up if we never had a keyframe
+    if(kind == NETSTREAM_KIND_KEYFRAME) {
+        dev->synced = true;
+    }
+    
+    const uint8_t *in = packet + 6;
+    if(mask & NETSTREAM_FIELD_BUTTONS) {
+        dev->state.buttons = in[0] | (in[1] << 8) | (in[2] << 16);
+        in += 3;
+    }
+    if(mask & NETSTREAM_FIELD_STICK_L)
+        in = netstream_get_stick(in, dev->state.stick_l);
+    if(mask & NETSTREAM_FIELD_STICK_R)
+        in = netstream_get_stick(in, dev->state.stick_r);
+    
+    return device;
+}
+
+void netstream_unsubscribe(NetStreamReceiver *rx) {
+    if(rx->fd < 0) return;
+    
+    netstream_receiver_send(rx, NETSTREAM_KIND_BYE);
+    close(rx->fd);
+    rx->fd = -1;
+}
\ No newline at end of file
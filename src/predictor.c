@@ -0,0 +1,150 @@
+/**
+*** :: predictor.c ::
+***
+***   Over Bluetooth a report only comes in every 8-15ms, with jitter
+***   on top, and the stick values in it are all uinput gets to see
+***   until the next one. So stick motion always reaches the consumer
+***   at least one report interval late.
+***
+***   The predictor keeps a smoothed velocity for every stick axis,
+***   timed by when each report was sampled (see timesync.c) rather
+***   than by when it happened to reach us. Between reports it sends
+***   out where the stick should be by now, on a steady host side tick.
+***   Since the guess starts from the sample time, that also covers the
+***   time the report spent in transit. Each guess is stamped with the
+***   time it is a guess for, the same way real frames carry their
+***   sample time. The next real report simply overwrites the guess.
+***
+***   To keep it from overshooting, a guess never reaches further than
+***   the horizon past the last real sample, never leaves the stick's
+***   range, never runs past the center when the stick is heading back
+***   to it, and the velocity is dropped as soon as the stick reverses.
+***
+**/
+
+#include "predictor.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* Same range and center the sticks are advertised with. */
+#define PREDICTOR_STICK_MIN (32)
+#define PREDICTOR_STICK_MAX (255 - 32)
+#define PREDICTOR_STICK_CENTER (128)
+
+/* Past this, two samples are too far apart to say anything about velocity. */
+#define PREDICTOR_MAX_GAP_US (100000)
+
+void predictor_init(Predictor *predictor, unsigned int axis_mask, uint64_t period_us, uint64_t horizon_us, double smoothing) {
+    memset(predictor, 0, sizeof(Predictor));
+    predictor->axis_mask = axis_mask;
+    predictor->period_us = period_us;
+    predictor->horizon_us = horizon_us;
+    predictor->smoothing = smoothing;
+}
+
+/**
+ * The stick values exactly as the decoders send them out.
+ */
+static void predictor_output_values(const ControllerState *state, int *values) {
+    values[0] = state->stick_l[0] >> 4;
+    values[1] = 256 - (state->stick_l[1] >> 4);
+    values[2] = state->stick_r[0] >> 4;
+    values[3] = 256 - (state->stick_r[1] >> 4);
+}
+
+/**
+ * Takes in the real stick values of the half(s) selected by type,
+ * right after they went out to uinput.
+ */
+void predictor_observe(Predictor *predictor, int type, const ControllerState *state, uint64_t sample_us) {
+    int values[PREDICTOR_AXES];
+    
+    predictor_output_values(state, values);
+    
+    for(int half = 0; half < 2; half++) {
+        if(!(type & (1 << half))) continue;
+        
+        uint64_t interval_us = predictor->have_sample[half] ? sample_us - predictor->last_sample_us[half] : 0;
+        
+        for(int i = half * 2; i < half * 2 + 2; i++) {
+            PredictorAxis *axis = &predictor->axes[i];
+            
+            if(!axis->valid || interval_us > PREDICTOR_MAX_GAP_US) {
+                axis->velocity = 0;
+            }
+            else if(interval_us > 0) {
+                double velocity = (values[i] - axis->value) / interval_us;
+                
+                // Reversals are where prediction overshoots, so start over from standing still
+                if(velocity * axis->velocity < 0)
+                    axis->velocity = 0;
+                axis->velocity += predictor->smoothing * (velocity - axis->velocity);
+            }
+            
+            axis->value = values[i];
+            axis->emitted = values[i];
+            axis->valid = true;
+        }
+        
+        predictor->have_sample[half] = true;
+        predictor->last_sample_us[half] = sample_us;
+    }
+    
+    predictor->next_tick_us = sample_us + predictor->period_us;
+}
+
+/**
+ * Produces the predicted stick values once the next tick is due.
+ * Returns how many events were placed into the array, which must hold
+ * PREDICTOR_AXES entries. Axes that wouldn't change aren't sent.
+ * predicted_us is set to the time the values are predicted for,
+ * which is now_us unless the horizon cut the guess short.
+ */
+int predictor_emit(Predictor *predictor, struct input_event *events, uint64_t now_us, uint64_t *predicted_us) {
+    static const int codes[PREDICTOR_AXES] = {ABS_X, ABS_Y, ABS_RX, ABS_RY};
+    struct input_event *ev = events;
+    
+    if(now_us < predictor->next_tick_us) return 0;
+    predictor->next_tick_us = now_us + predictor->period_us;
+    *predicted_us = 0;
+    
+    for(int i = 0; i < PREDICTOR_AXES; i++) {
+        PredictorAxis *axis = &predictor->axes[i];
+        if(!(predictor->axis_mask & (1 << i)) || !axis->valid || axis->velocity == 0) continue;
+        
+        uint64_t elapsed_us = now_us - predictor->last_sample_us[i / 2];
+        if(elapsed_us > predictor->horizon_us)
+            elapsed_us = predictor->horizon_us;
+        
+        double predicted = axis->value + axis->velocity * elapsed_us;
+        
+        // Springing back to center, stop right there
+        double from_center = axis->value - PREDICTOR_STICK_CENTER;
+        if(from_center * axis->velocity < 0 && (predicted - PREDICTOR_STICK_CENTER) * from_center < 0)
+            predicted = PREDICTOR_STICK_CENTER;
+        
+        // Nor further out than the advertised range, unless the stick really is out there
+        if(predicted < PREDICTOR_STICK_MIN) predicted = fmin(axis->value, PREDICTOR_STICK_MIN);
+        if(predicted > PREDICTOR_STICK_MAX) predicted = fmax(axis->value, PREDICTOR_STICK_MAX);
+        
+        int value = (int)lround(predicted);
+        if(value == axis->emitted) continue;
+        axis->emitted = value;
+        
+        if(predictor->last_sample_us[i / 2] + elapsed_us > *predicted_us)
+            *predicted_us = predictor->last_sample_us[i / 2] + elapsed_us;
+        
+        memset(ev, 0, sizeof(struct input_event));
+        ev->type = EV_ABS;
+        ev->code = codes[i];
+        ev->value = value;
+        ev++;
+    }
+    
+    predictor->predictions_emitted += ev - events;
+    return ev - events;
+}
\ No newline at end of file
@@ -0,0 +1,301 @@
+/**
+*** :: statestore.c ::
+***
+***   With one controller, decoding a report byte by byte is cheap
+***   enough. With a room full of them, every report takes its own
+***   trip through the same shifts and masks, and the decoded state
+***   ends up scattered over as many structs.
+***
+***   Here every field of every device lives in its own array, and
+***   reports are decoded in batches of STATESTORE_BATCH: the stick and
+***   button bytes of a batch are loaded one register per report and
+***   transposed into one row per byte, after which unpacking the 12 bit
+***   stick pairs and building the button words is a handful of vector
+***   operations for the whole batch. Batches of neighbouring devices
+***   are stored straight into the arrays. The scalar path does the same
+***   arithmetic one report at a time, and produces bit-identical
+***   results; it's used for leftovers that don't fill a batch, and on
+***   machines without SSE2. IMU samples of neighbouring devices go the
+***   same way, through an 8x8 transpose of 16 bit words.
+***
+**/
+
+#include "statestore.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Where buttons_r starts, the 9 button and stick bytes follow it. */
+#define STATESTORE_BUTTONS_OFFSET (offsetof(InputPacket, buttons_r))
+
+void statestore_init(StateStore *store) {
+    memset(store, 0, sizeof(StateStore));
+}
+
+/**
+ * IMU samples, timer and timestamp of a single report.
+ */
+static void statestore_decode_common(StateStore *store, int device, const unsigned char *report, uint64_t now_us) {
+    const InputPacket *input = (const InputPacket*)report;
+    
+    for(int sample = 0; sample < STATESTORE_IMU_SAMPLES; sample++) {
+        const uint8_t *imu = input->imu[sample];
+        for(int axis = 0; axis < 3; axis++) {
+            store->accel[axis][sample][device] = (int16_t)(imu[axis * 2] | (imu[axis * 2 + 1] << 8));
+            store->gyro[axis][sample][device] = (int16_t)(imu[6 + axis * 2] | (imu[6 + axis * 2 + 1] << 8));
+        }
+    }
+    
+    store->timer[device] = input->timer;
+    store->updated_us[device] = now_us;
+}
+
+/**
+ * Decodes one report after another. Reference for the vector path.
+ */
+void statestore_decode_scalar(StateStore *store, const int *devices, unsigned char *const *reports, int count, uint64_t now_us) {
+    for(int i = 0; i < count; i++) {
+        const InputPacket *input = (const InputPacket*)reports[i];
+        int device = devices[i];
+        
+        if(device < 0 || device >= STATESTORE_MAX_DEVICES) continue;
+        
+        store->buttons[device] = (input->buttons_r | (input->buttons_middle << 8) | (input->buttons_l << 16)) & STATESTORE_BUTTONS_MASK;
+        store->stick_lx[device] = input->sticks[0] | ((input->sticks[1] & 0x0F) << 8);
+        store->stick_ly[device] = (input->sticks[1] >> 4) | (input->sticks[2] << 4);
+        store->stick_rx[device] = input->sticks[3] | ((input->sticks[4] & 0x0F) << 8);
+        store->stick_ry[device] = (input->sticks[4] >> 4) | (input->sticks[5] << 4);
+        
+        statestore_decode_common(store, device, reports[i], now_us);
+    }
+}
+
+#ifdef __SSE2__
+/**
+ * Transposes an 8x8 block of 16 bit words.
+ */
+static inline void statestore_transpose8x16(const __m128i *in, __m128i *out) {
+    __m128i t0 = _mm_unpacklo_epi16(in[0], in[1]);
+    __m128i t1 = _mm_unpackhi_epi16(in[0], in[1]);
+    __m128i t2 = _mm_unpacklo_epi16(in[2], in[3]);
+    __m128i t3 = _mm_unpackhi_epi16(in[2], in[3]);
+    __m128i t4 = _mm_unpacklo_epi16(in[4], in[5]);
+    __m128i t5 = _mm_unpackhi_epi16(in[4], in[5]);
+    __m128i t6 = _mm_unpacklo_epi16(in[6], in[7]);
+    __m128i t7 = _mm_unpackhi_epi16(in[6], in[7]);
+    
+    __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+    __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+    __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+    __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+    __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+    __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+    __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+    __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+    
+    out[0] = _mm_unpacklo_epi64(u0, u4);
+    out[1] = _mm_unpackhi_epi64(u0, u4);
+    out[2] = _mm_unpacklo_epi64(u1, u5);
+    out[3] = _mm_unpackhi_epi64(u1, u5);
+    out[4] = _mm_unpacklo_epi64(u2, u6);
+    out[5] = _mm_unpackhi_epi64(u2, u6);
+    out[6] = _mm_unpacklo_epi64(u3, u7);
+    out[7] = _mm_unpackhi_epi64(u3, u7);
+}
+
+/**
+ * Where the n-th int16 of the IMU block goes, for a given device.
+ */
+static inline int16_t *statestore_imu_lane(StateStore *store, int word, int device) {
+    int sample = word / 6;
+    int axis = word % 6;
+    
+    if(axis < 3) return &store->accel[axis][sample][device];
+    return &store->gyro[axis - 3][sample][device];
+}
+
+/**
+ * IMU samples of a batch of neighbouring devices, transposed 8 words
+ * at a time so every row lands in its lanes with a single store.
+ */
+static void statestore_decode_batch_imu(StateStore *store, int first, unsigned char *const *reports) {
+    __m128i in[STATESTORE_BATCH], out[STATESTORE_BATCH];
+    int16_t *base[18];
+    
+    for(int word = 0; word < 18; word++) {
+        base[word] = statestore_imu_lane(store, word, first);
+    }
+    
+    for(int block = 0; block < 2; block++) {
+        for(int i = 0; i < STATESTORE_BATCH; i++) {
+            in[i] = _mm_loadu_si128((const __m128i*)(reports[i] + offsetof(InputPacket, imu) + block * 16));
+        }
+        statestore_transpose8x16(in, out);
+        
+        for(int row = 0; row < 8; row++) {
+            _mm_storeu_si128((__m128i*)base[block * 8 + row], out[row]);
+        }
+    }
+    
+    // The last two words don't fill a block, and a load would run off the report
+    for(int i = 0; i < STATESTORE_BATCH; i++) {
+        const uint8_t *imu = reports[i] + offsetof(InputPacket, imu);
+        for(int word = 16; word < 18; word++) {
+            base[word][i] = (int16_t)(imu[word * 2] | (imu[word * 2 + 1] << 8));
+        }
+    }
+}
+
+/**
+ * Decodes exactly STATESTORE_BATCH reports.
+ */
+static void statestore_decode_batch(StateStore *store, const int *devices, unsigned char *const *reports, uint64_t now_us) {
+    uint32_t buttons[STATESTORE_BATCH] __attribute__((aligned(16)));
+    uint16_t sticks[4][STATESTORE_BATCH] __attribute__((aligned(16)));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_nibble = _mm_set1_epi16(0x0F);
+    const __m128i buttons_mask = _mm_set1_epi32(STATESTORE_BUTTONS_MASK);
+    __m128i v[STATESTORE_BATCH];
+    
+    for(int i = 0; i < STATESTORE_BATCH; i++) {
+        v[i] = _mm_loadu_si128((const __m128i*)(reports[i] + STATESTORE_BUTTONS_OFFSET));
+    }
+    
+    // Transpose 8 reports x 9 bytes, so each row holds one byte of every report
+    __m128i a01 = _mm_unpacklo_epi8(v[0], v[1]);
+    __m128i a23 = _mm_unpacklo_epi8(v[2], v[3]);
+    __m128i a45 = _mm_unpacklo_epi8(v[4], v[5]);
+    __m128i a67 = _mm_unpacklo_epi8(v[6], v[7]);
+    __m128i a01h = _mm_unpackhi_epi8(v[0], v[1]);
+    __m128i a23h = _mm_unpackhi_epi8(v[2], v[3]);
+    __m128i a45h = _mm_unpackhi_epi8(v[4], v[5]);
+    __m128i a67h = _mm_unpackhi_epi8(v[6], v[7]);
+    
+    __m128i b0123 = _mm_unpacklo_epi16(a01, a23);
+    __m128i b4567 = _mm_unpacklo_epi16(a45, a67);
+    __m128i b0123h = _mm_unpackhi_epi16(a01, a23);
+    __m128i b4567h = _mm_unpackhi_epi16(a45, a67);
+    __m128i b8 = _mm_unpacklo_epi32(_mm_unpacklo_epi16(a01h, a23h), _mm_unpacklo_epi16(a45h, a67h));
+    
+    __m128i rows01 = _mm_unpacklo_epi32(b0123, b4567);
+    __m128i rows23 = _mm_unpackhi_epi32(b0123, b4567);
+    __m128i rows45 = _mm_unpacklo_epi32(b0123h, b4567h);
+    __m128i rows67 = _mm_unpackhi_epi32(b0123h, b4567h);
+    
+    // Widen to 16 bit lanes. b[0..2] are buttons_r, buttons_middle, buttons_l, b[3..8] the sticks
+    __m128i b[9];
+    b[0] = _mm_unpacklo_epi8(rows01, zero);
+    b[1] = _mm_unpackhi_epi8(rows01, zero);
+    b[2] = _mm_unpacklo_epi8(rows23, zero);
+    b[3] = _mm_unpackhi_epi8(rows23, zero);
+    b[4] = _mm_unpacklo_epi8(rows45, zero);
+    b[5] = _mm_unpackhi_epi8(rows45, zero);
+    b[6] = _mm_unpacklo_epi8(rows67, zero);
+    b[7] = _mm_unpackhi_epi8(rows67, zero);
+    b[8] = _mm_unpacklo_epi8(b8, zero);
+    
+    __m128i buttons_low = _mm_or_si128(b[0], _mm_slli_epi16(b[1], 8));
+    __m128i buttons_0123 = _mm_and_si128(_mm_unpacklo_epi16(buttons_low, b[2]), buttons_mask);
+    __m128i buttons_4567 = _mm_and_si128(_mm_unpackhi_epi16(buttons_low, b[2]), buttons_mask);
+    
+    __m128i lx = _mm_or_si128(b[3], _mm_slli_epi16(_mm_and_si128(b[4], low_nibble), 8));
+    __m128i ly = _mm_or_si128(_mm_srli_epi16(b[4], 4), _mm_slli_epi16(b[5], 4));
+    __m128i rx = _mm_or_si128(b[6], _mm_slli_epi16(_mm_and_si128(b[7], low_nibble), 8));
+    __m128i ry = _mm_or_si128(_mm_srli_epi16(b[7], 4), _mm_slli_epi16(b[8], 4));
+    
+    bool contiguous = true;
+    for(int i = 1; i < STATESTORE_BATCH; i++) {
+        contiguous &= devices[i] == devices[0] + i;
+    }
+    
+    if(contiguous) {
+        int first = devices[0];
+        _mm_storeu_si128((__m128i*)&store->buttons[first], buttons_0123);
+        _mm_storeu_si128((__m128i*)&store->buttons[first + 4], buttons_4567);
+        _mm_storeu_si128((__m128i*)&store->stick_lx[first], lx);
+        _mm_storeu_si128((__m128i*)&store->stick_ly[first], ly);
+        _mm_storeu_si128((__m128i*)&store->stick_rx[first], rx);
+        _mm_storeu_si128((__m128i*)&store->stick_ry[first], ry);
+    }
+    else {
+        // Devices of a batch don't have to be neighbours, so scatter them back
+        _mm_store_si128((__m128i*)&buttons[0], buttons_0123);
+        _mm_store_si128((__m128i*)&buttons[4], buttons_4567);
+        _mm_store_si128((__m128i*)sticks[0], lx);
+        _mm_store_si128((__m128i*)sticks[1], ly);
+        _mm_store_si128((__m128i*)sticks[2], rx);
+        _mm_store_si128((__m128i*)sticks[3], ry);
+        
+        for(int i = 0; i < STATESTORE_BATCH; i++) {
+            int device = devices[i];
+            store->buttons[device] = buttons[i];
+            store->stick_lx[device] = sticks[0][i];
+            store->stick_ly[device] = sticks[1][i];
+            store->stick_rx[device] = sticks[2][i];
+            store->stick_ry[device] = sticks[3][i];
+        }
+    }
+    
+    // Scattered IMU lanes gain nothing from a transpose, the scalar copy is as good
+    if(contiguous) {
+        statestore_decode_batch_imu(store, devices[0], reports);
+        
+        for(int i = 0; i < STATESTORE_BATCH; i++) {
+            const InputPacket *input = (const InputPacket*)reports[i];
+            store->timer[devices[i]] = input->timer;
+            store->updated_us[devices[i]] = now_us;
+        }
+    }
+    else {
+        for(int i = 0; i < STATESTORE_BATCH; i++) {
+            statestore_decode_common(store, devices[i], reports[i], now_us);
+        }
+    }
+}
+#endif
+
+/**
+ * Decodes count reports, reports[i] going into device devices[i].
+ * Reports are in InputPacket layout.
+ */
+void statestore_decode(StateStore *store, const int *devices, unsigned char *const *reports, int count, uint64_t now_us) {
+#ifdef __SSE2__
+    int valid_devices[STATESTORE_BATCH];
+    unsigned char *valid_reports[STATESTORE_BATCH];
+    int pending = 0;
+    
+    for(int i = 0; i < count; i++) {
+        if(devices[i] < 0 || devices[i] >= STATESTORE_MAX_DEVICES) continue;
+        
+        valid_devices[pending] = devices[i];
+        valid_reports[pending] = reports[i];
+        
+        if(++pending == STATESTORE_BATCH) {
+            statestore_decode_batch(store, valid_devices, valid_reports, now_us);
+            pending = 0;
+        }
+    }
+    
+    statestore_decode_scalar(store, valid_devices, valid_reports, pending, now_us);
+#else
+    statestore_decode_scalar(store, devices, reports, count, now_us);
+#endif
+}
+
+/**
+ * Gathers one device back into a ControllerState.
+ */
+void statestore_get(const StateStore *store, int device, ControllerState *state) {
+    state->buttons = store->buttons[device];
+    state->stick_l[0] = store->stick_lx[device];
+    state->stick_l[1] = store->stick_ly[device];
+    state->stick_r[0] = store->stick_rx[device];
+    state->stick_r[1] = store->stick_ry[device];
+}
\ No newline at end of file
@@ -0,0 +1,450 @@
+/**
+*** :: telemetry.c ::
+***
+***   Ring, writer thread and block codec behind telemetry.h.
+***
+***   Hardly anything in a sample changes from one IMU reading to the
+***   next: buttons and sticks repeat for all three readings of a report,
+***   the time steps by the same 5ms, and a resting IMU only wiggles in
+***   its lowest bits. So every column is turned into small residuals
+***   first, and each group of them is then packed into just as many
+***   bits as its largest one needs. A group that didn't change at all
+***   costs a single byte.
+***
+**/
+
+#include "telemetry.h"
+#include "motion.h"
+#include "wengine.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+static uint32_t telemetry_zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t telemetry_unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static uint8_t *telemetry_put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+    return out + 2;
+}
+
+static uint8_t *telemetry_put_u32(uint8_t *out, uint32_t value) {
+    out = telemetry_put_u16(out, value & 0xFFFF);
+    return telemetry_put_u16(out, value >> 16);
+}
+
+static uint8_t *telemetry_put_u64(uint8_t *out, uint64_t value) {
+    out = telemetry_put_u32(out, value & 0xFFFFFFFF);
+    return telemetry_put_u32(out, value >> 32);
+}
+
+/**
+ * Packs count residuals, group by group. Returns the end of what was written.
+ */
+static uint8_t *telemetry_pack(uint8_t *out, const uint32_t *residuals, int count) {
+    for(int first = 0; first < count; first += TELEMETRY_GROUP) {
+        int n = count - first < TELEMETRY_GROUP ? count - first : TELEMETRY_GROUP;
+        uint32_t all = 0;
+        
+        for(int i = 0; i < n; i++) {
+            all |= residuals[first + i];
+        }
+        int width = all ? 32 - __builtin_clz(all) : 0;
+        *out++ = width;
+        
+        uint64_t bits = 0;
+        int used = 0;
+        for(int i = 0; i < n && width; i++) {
+            bits |= (uint64_t)residuals[first + i] << used;
+            used += width;
+            while(used >= 8) {
+                *out++ = bits & 0xFF;
+                bits >>= 8;
+                used -= 8;
+            }
+        }
+        if(used > 0) {
+            *out++ = bits & 0xFF;
+        }
+    }
+    
+    return out;
+}
+
+/**
+ * Reverse of telemetry_pack. Returns the end of what was read,
+ * or NULL if it would run past end.
+ */
+static const uint8_t *telemetry_unpack(const uint8_t *in, const uint8_t *end, uint32_t *residuals, int count) {
+    for(int first = 0; first < count; first += TELEMETRY_GROUP) {
+        int n = count - first < TELEMETRY_GROUP ? count - first : TELEMETRY_GROUP;
+        
+        if(in >= end) return NULL;
+        int width = *in++;
+        if(width > 32 || end - in < (n * width + 7) / 8) return NULL;
+        
+        uint64_t bits = 0;
+        int have = 0;
+        uint32_t mask = width == 32 ? 0xFFFFFFFF : (1U << width) - 1;
+        for(int i = 0; i < n; i++) {
+            while(have < width) {
+                bits |= (uint64_t)*in++ << have;
+                have += 8;
+            }
+            residuals[first + i] = width ? bits & mask : 0;
+            bits >>= width;
+            have -= width;
+        }
+    }
+    
+    return in;
+}
+
+/**
+ * Reads one of the stick or IMU columns of a sample, numbered in the order they're written.
+ */
+static int32_t telemetry_column(const TelemetrySample *sample, int column) {
+    if(column < 6) return sample->sticks[column - 2];
+    if(column < 9) return sample->accel[column - 6];
+    return sample->gyro[column - 9];
+}
+
+static void telemetry_set_column(TelemetrySample *sample, int column, int32_t value) {
+    if(column < 6) sample->sticks[column - 2] = value;
+    else if(column < 9) sample->accel[column - 6] = value;
+    else sample->gyro[column - 9] = value;
+}
+
+/**
+ * Writes the column data of a block of samples, all from one device and
+ * no more than TELEMETRY_MAX_GAP_US apart. out must hold TELEMETRY_MAX_BLOCK
+ * bytes. Returns how many were written.
+ */
+int telemetry_encode_block(const TelemetrySample *samples, int count, uint8_t *out) {
+    uint32_t residuals[TELEMETRY_BLOCK_SAMPLES] = {0};
+    uint8_t *start = out;
+    
+    if(count <= 0 || count > TELEMETRY_BLOCK_SAMPLES) return 0;
+    
+    // Time, as deltas of deltas
+    int64_t delta = 0;
+    for(int i = 0; i < count; i++) {
+        int64_t next = i ? (int64_t)(samples[i].sample_us - samples[i - 1].sample_us) : 0;
+        residuals[i] = telemetry_zigzag((int32_t)(next - delta));
+        delta = next;
+    }
+    out = telemetry_pack(out, residuals, count);
+    
+    // Buttons, as the bits that flipped
+    uint32_t buttons = 0;
+    for(int i = 0; i < count; i++) {
+        residuals[i] = samples[i].buttons ^ buttons;
+        buttons = samples[i].buttons;
+    }
+    out = telemetry_pack(out, residuals, count);
+    
+    // Sticks and IMU, as deltas
+    for(int column = 2; column < TELEMETRY_COLUMNS; column++) {
+        int32_t previous = 0;
+        for(int i = 0; i < count; i++) {
+            int32_t value = telemetry_column(&samples[i], column);
+            residuals[i] = telemetry_zigzag(value - previous);
+            previous = value;
+        }
+        out = telemetry_pack(out, residuals, count);
+    }
+    
+    return out - start;
+}
+
+/**
+ * Reverse of telemetry_encode_block. The device field is left for the
+ * caller to fill in. Returns 0 on success, -1 if the data is damaged.
+ */
+int telemetry_decode_block(const uint8_t *in, int size, int count, uint64_t first_us, TelemetrySample *samples) {
+    uint32_t residuals[TELEMETRY_BLOCK_SAMPLES];
+    const uint8_t *end = in + size;
+    
+    if(count <= 0 || count > TELEMETRY_BLOCK_SAMPLES) return -1;
+    
+    in = telemetry_unpack(in, end, residuals, count);
+    if(in == NULL) return -1;
+    
+    int64_t delta = 0;
+    uint64_t sample_us = first_us;
+    for(int i = 0; i < count; i++) {
+        delta += telemetry_unzigzag(residuals[i]);
+        sample_us += delta;
+        samples[i].sample_us = sample_us;
+    }
+    
+    in = telemetry_unpack(in, end, residuals, count);
+    if(in == NULL) return -1;
+    
+    uint32_t buttons = 0;
+    for(int i = 0; i < count; i++) {
+        buttons ^= residuals[i];
+        samples[i].buttons = buttons;
+    }
+    
+    for(int column = 2; column < TELEMETRY_COLUMNS; column++) {
+        in = telemetry_unpack(in, end, residuals, count);
+        if(in == NULL) return -1;
+        
+        int32_t value = 0;
+        for(int i = 0; i < count; i++) {
+            value += telemetry_unzigzag(residuals[i]);
+            telemetry_set_column(&samples[i], column, value);
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Encodes and writes out whatever a device has gathered so far.
+ */
+static void telemetry_write_block(TelemetryRecorder *recorder, int device) {
+    TelemetryBlock *block = &recorder->blocks[device];
+    if(block->count == 0) return;
+    
+    uint8_t *header = recorder->buffer;
+    int size = telemetry_encode_block(block->samples, block->count, header + TELEMETRY_BLOCK_HEADER);
+    
+    header[0] = TELEMETRY_BLOCK_MAGIC;
+    header[1] = device;
+    telemetry_put_u16(header + 2, block->count);
+    telemetry_put_u32(header + 4, size);
+    telemetry_put_u64(header + 8, block->samples[0].sample_us);
+    telemetry_put_u64(header + 16, block->samples[block->count - 1].sample_us);
+    
+    if(recorder->file && fwrite(header, TELEMETRY_BLOCK_HEADER + size, 1, recorder->file) == 1) {
+        atomic_fetch_add_explicit(&recorder->samples_written, block->count, memory_order_relaxed);
+        atomic_fetch_add_explicit(&recorder->bytes_written, TELEMETRY_BLOCK_HEADER + size, memory_order_relaxed);
+    }
+    else {
+        // No file to go into, as lost as if the ring had been full
+        atomic_fetch_add_explicit(&recorder->dropped, block->count, memory_order_relaxed);
+    }
+    block->count = 0;
+}
+
+static void telemetry_flush(TelemetryRecorder *recorder) {
+    for(int device = 0; device < TELEMETRY_MAX_DEVICES; device++) {
+        telemetry_write_block(recorder, device);
+    }
+    if(recorder->file) fflush(recorder->file);
+}
+
+/**
+ * Starts a new file, named after the wall clock time it was opened at.
+ * Returns 0 on success, -1 otherwise.
+ */
+static int telemetry_rotate(TelemetryRecorder *recorder, uint64_t now_us) {
+    uint8_t header[TELEMETRY_FILE_HEADER] = {0};
+    char path[4096 + 64];
+    struct timespec wall;
+    struct tm tm;
+    
+    telemetry_flush(recorder);
+    if(recorder->file) {
+        fclose(recorder->file);
+        recorder->file = NULL;
+    }
+    
+    clock_gettime(CLOCK_REALTIME, &wall);
+    localtime_r(&wall.tv_sec, &tm);
+    int len = snprintf(path, sizeof(path), "%s/wyatt-%04d%02d%02d-%02d%02d%02d", recorder->dir,
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    
+    // Names only go down to the second, never clobber a file from the same one
+    for(int suffix = 0; suffix < TELEMETRY_MAX_SUFFIX; suffix++) {
+        if(suffix == 0)
+            snprintf(path + len, sizeof(path) - len, ".wtl");
+        else
+            snprintf(path + len, sizeof(path) - len, "-%d.wtl", suffix);
+        
+        recorder->file = fopen(path, "wbx");
+        if(recorder->file || errno != EEXIST) break;
+    }
+    recorder->file_opened_us = now_us;
+    if(recorder->file == NULL) {
+        printf("Failed to open telemetry file %s\n", path);
+        return -1;
+    }
+    
+    memcpy(header, TELEMETRY_MAGIC, 4);
+    telemetry_put_u16(header + 4, TELEMETRY_VERSION);
+    telemetry_put_u64(header + 8, now_us);
+    telemetry_put_u64(header + 16, wall.tv_sec * 1000000ULL + wall.tv_nsec / 1000);
+    fwrite(header, sizeof(header), 1, recorder->file);
+    atomic_fetch_add_explicit(&recorder->bytes_written, sizeof(header), memory_order_relaxed);
+    
+    return 0;
+}
+
+/**
+ * Files a sample under its device, writing the block out first
+ * if it's full or the sample doesn't belong with it.
+ */
+static void telemetry_gather(TelemetryRecorder *recorder, const TelemetrySample *sample) {
+    if(sample->device >= TELEMETRY_MAX_DEVICES) return;
+    TelemetryBlock *block = &recorder->blocks[sample->device];
+    
+    if(block->count > 0) {
+        uint64_t last_us = block->samples[block->count - 1].sample_us;
+        if(block->count == TELEMETRY_BLOCK_SAMPLES || sample->sample_us < last_us
+            || sample->sample_us - last_us > TELEMETRY_MAX_GAP_US)
+            telemetry_write_block(recorder, sample->device);
+    }
+    
+    block->samples[block->count++] = *sample;
+}
+
+static void *telemetry_thread(void *user) {
+    TelemetryRecorder *recorder = user;
+    
+    while(true) {
+        bool stopping = atomic_load_explicit(&recorder->stop, memory_order_acquire);
+        unsigned int head = atomic_load_explicit(&recorder->head, memory_order_acquire);
+        unsigned int tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+        
+        for(; tail != head; tail++) {
+            telemetry_gather(recorder, &recorder->ring[tail & (TELEMETRY_RING_SIZE - 1)]);
+        }
+        atomic_store_explicit(&recorder->tail, tail, memory_order_release);
+        
+        if(stopping) break;
+        
+        // Partial blocks still go out now and then, a crash shouldn't cost more than that
+        uint64_t now_us = wengine_now_us();
+        if(now_us - recorder->file_opened_us >= recorder->rotate_us) {
+            telemetry_rotate(recorder, now_us);
+            recorder->flushed_us = now_us;
+        }
+        else if(now_us - recorder->flushed_us >= TELEMETRY_FLUSH_PERIOD_US) {
+            telemetry_flush(recorder);
+            recorder->flushed_us = now_us;
+        }
+        
+        usleep(TELEMETRY_IDLE_SLEEP_US);
+    }
+    
+    telemetry_flush(recorder);
+    return NULL;
+}
+
+/**
+ * Starts recording into files under dir, a new one every rotate_us.
+ * Returns 0 on success, -1 otherwise.
+ */
+int telemetry_open(TelemetryRecorder *recorder, const char *dir, uint64_t rotate_us) {
+    memset(recorder, 0, sizeof(TelemetryRecorder));
+    snprintf(recorder->dir, sizeof(recorder->dir), "%s", dir);
+    recorder->rotate_us = rotate_us ? rotate_us : TELEMETRY_DEFAULT_ROTATE_US;
+    
+    recorder->ring = calloc(TELEMETRY_RING_SIZE, sizeof(TelemetrySample));
+    recorder->blocks = calloc(TELEMETRY_MAX_DEVICES, sizeof(TelemetryBlock));
+    recorder->buffer = malloc(TELEMETRY_BLOCK_HEADER + TELEMETRY_MAX_BLOCK);
+    if(!recorder->ring || !recorder->blocks || !recorder->buffer)
+        goto fail;
+    
+    recorder->flushed_us = wengine_now_us();
+    if(telemetry_rotate(recorder, recorder->flushed_us))
+        goto fail;
+    
+    if(pthread_create(&recorder->thread, NULL, telemetry_thread, recorder)) {
+        printf("Failed to start telemetry thread\n");
+        goto fail;
+    }
+    
+    recorder->running = true;
+    return 0;
+    
+fail:
+    if(recorder->file) fclose(recorder->file);
+    free(recorder->ring);
+    free(recorder->blocks);
+    free(recorder->buffer);
+    memset(recorder, 0, sizeof(TelemetryRecorder));
+    return -1;
+}
+
+/**
+ * Queues up the IMU readings a device got since its last report,
+ * oldest first, each with the buttons and sticks of this report.
+ * Called from the input thread, so all it does is fill ring slots.
+ * Samples that don't fit are dropped and counted.
+ */
+void telemetry_record(TelemetryRecorder *recorder, int device, const ControllerState *state, const StateStore *store, int store_device, uint64_t sample_us) {
+    if(!recorder->running || device < 0 || device >= TELEMETRY_MAX_DEVICES) return;
+    
+    // Same as motion_emit, reports can come in faster than the IMU fills them
+    int samples = STATESTORE_IMU_SAMPLES;
+    if(recorder->last_us[device]) {
+        samples = (sample_us - recorder->last_us[device] + MOTION_SAMPLE_US / 2) / MOTION_SAMPLE_US;
+        if(samples < 1) samples = 1;
+        if(samples > STATESTORE_IMU_SAMPLES) samples = STATESTORE_IMU_SAMPLES;
+    }
+    recorder->last_us[device] = sample_us;
+    
+    unsigned int head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&recorder->tail, memory_order_acquire);
+    
+    for(int i = STATESTORE_IMU_SAMPLES - samples; i < STATESTORE_IMU_SAMPLES; i++) {
+        if(head - tail >= TELEMETRY_RING_SIZE) {
+            atomic_fetch_add_explicit(&recorder->dropped, STATESTORE_IMU_SAMPLES - i, memory_order_relaxed);
+            break;
+        }
+        
+        TelemetrySample *sample = &recorder->ring[head & (TELEMETRY_RING_SIZE - 1)];
+        sample->sample_us = sample_us - (STATESTORE_IMU_SAMPLES - 1 - i) * MOTION_SAMPLE_US;
+        sample->device = device;
+        sample->buttons = state->buttons;
+        sample->sticks[0] = state->stick_l[0];
+        sample->sticks[1] = state->stick_l[1];
+        sample->sticks[2] = state->stick_r[0];
+        sample->sticks[3] = state->stick_r[1];
+        for(int axis = 0; axis < 3; axis++) {
+            sample->accel[axis] = store->accel[axis][i][store_device];
+            sample->gyro[axis] = store->gyro[axis][i][store_device];
+        }
+        head++;
+    }
+    
+    atomic_store_explicit(&recorder->head, head, memory_order_release);
+}
+
+/**
+ * Stops the writer thread once it has written out everything
+ * still queued, and closes the current file.
+ */
+void telemetry_close(TelemetryRecorder *recorder) {
+    if(!recorder->running) return;
+    
+    atomic_store_explicit(&recorder->stop, true, memory_order_release);
+    pthread_join(recorder->thread, NULL);
+    recorder->running = false;
+    
+    printf("Telemetry: %llu samples in %llu bytes, %llu dropped\n",
+        (unsigned long long)atomic_load(&recorder->samples_written),
+        (unsigned long long)atomic_load(&recorder->bytes_written),
+        (unsigned long long)atomic_load(&recorder->dropped));
+    
+    if(recorder->file) fclose(recorder->file);
+    free(recorder->ring);
+    free(recorder->blocks);
+    free(recorder->buffer);
+}
\ No newline at end of file
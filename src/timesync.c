@@ -0,0 +1,96 @@
+/**
+*** :: timesync.c ::
+***
+***   A report reaches us after however long the radio, the kernel and
+***   our own poll loop took to get it here, which is anything but
+***   constant. The controller's timer doesn't care about any of that.
+***
+***   The timer gets unwrapped into a running tick count, and the length
+***   of a tick is the slope of a least squares fit of arrival time over
+***   ticks. Arrival jitter doesn't lean either way, so it averages out
+***   of the slope. The report that made it here fastest sets where
+***   tick 0 lies on the host clock. That offset creeps upwards slowly,
+***   so it can follow a controller clock whose rate wanders.
+***
+***   Until enough ticks have passed to know their length, or after a
+***   gap long enough for the timer to have wrapped unseen, samples are
+***   simply taken to be as old as their arrival.
+***
+**/
+
+#include "timesync.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Ticks it takes the 8 bit timer to come back around. */
+#define TIMESYNC_TIMER_TICKS (256)
+
+/* How far the offset follows reports that took longer than the best one. */
+#define TIMESYNC_CREEP_ALPHA (0.0005)
+
+void timesync_init(TimeSync *sync) {
+    memset(sync, 0, sizeof(TimeSync));
+}
+
+/**
+ * Returns the host time the report carrying this timer value was
+ * sampled at. Never later than its arrival, and never earlier than
+ * the sample before it.
+ */
+uint64_t timesync_map(TimeSync *sync, uint8_t timer, uint64_t arrival_us) {
+    uint8_t delta = timer - sync->last_timer;
+    
+    // The timer may have wrapped who knows how often, start over
+    if(sync->valid && sync->tick_us > 0 && arrival_us - sync->last_arrival_us > TIMESYNC_TIMER_TICKS * sync->tick_us)
+        sync->valid = false;
+    
+    if(!sync->valid) {
+        timesync_init(sync);
+        sync->valid = true;
+        sync->last_timer = timer;
+        sync->anchor_us = arrival_us;
+        sync->last_arrival_us = arrival_us;
+        sync->last_sample_us = arrival_us;
+        sync->offset_us = arrival_us;
+        sync->samples = 1;
+        return arrival_us;
+    }
+    
+    sync->ticks += delta;
+    sync->last_timer = timer;
+    sync->last_arrival_us = arrival_us;
+    
+    // Welford style update of the fit, numbers stay small relative to the anchor
+    double x = (double)sync->ticks;
+    double y = (double)(arrival_us - sync->anchor_us);
+    double dx = x - sync->mean_ticks;
+    sync->samples++;
+    sync->mean_ticks += dx / sync->samples;
+    sync->mean_arrival += (y - sync->mean_arrival) / sync->samples;
+    sync->sxx += dx * (x - sync->mean_ticks);
+    sync->sxy += dx * (y - sync->mean_arrival);
+    if(sync->sxx > 0)
+        sync->tick_us = sync->sxy / sync->sxx;
+    
+    uint64_t sample_us = arrival_us;
+    if(sync->ticks >= TIMESYNC_MIN_TICKS && sync->tick_us > 0) {
+        double offset_us = arrival_us - sync->ticks * sync->tick_us;
+        if(offset_us < sync->offset_us)
+            sync->offset_us = offset_us;
+        else
+            sync->offset_us += TIMESYNC_CREEP_ALPHA * (offset_us - sync->offset_us);
+        
+        sample_us = (uint64_t)(sync->offset_us + sync->ticks * sync->tick_us);
+        if(sample_us > arrival_us)
+            sample_us = arrival_us;
+    }
+    
+    if(sample_us < sync->last_sample_us)
+        sample_us = sync->last_sample_us;
+    sync->last_sample_us = sample_us;
+    
+    return sample_us;
+}
\ No newline at end of file
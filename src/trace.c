@@ -0,0 +1,142 @@
+/**
+*** :: trace.c ::
+***
+***   Backing for the probe points in trace.h. Device slots are keyed
+***   by something that names one physical controller, its serial or
+***   its hidraw path, rather than by hid handle. So the counters of a
+***   controller keep adding up across reconnects even though its handle
+***   changes, and two of the same model don't end up sharing a slot.
+***
+***   Sending the process SIGUSR1 prints all counters from the poll loop.
+***
+**/
+
+#include "trace.h"
+#include "wengine.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+TraceDevice trace_devices[TRACE_MAX_DEVICES];
+int trace_marker_fd = -1;
+
+static volatile sig_atomic_t trace_dump_requested = 0;
+
+static void trace_on_signal(int signal) {
+    (void)signal;
+    trace_dump_requested = 1;
+}
+
+/**
+ * Opens the trace_marker when WYATT_TRACE is set, and hooks up SIGUSR1.
+ */
+void trace_init(void) {
+    strcpy(trace_devices[TRACE_UNKNOWN_DEVICE].name, "unknown");
+    
+    if(wengine_env_long("WYATT_TRACE", 0)) {
+        trace_marker_fd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if(trace_marker_fd < 0)
+            trace_marker_fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if(trace_marker_fd < 0)
+            printf("Failed to open trace_marker, only USDT probes will fire...\n");
+    }
+    
+    signal(SIGUSR1, trace_on_signal);
+}
+
+/**
+ * Binds a hid handle to the slot for the given device key,
+ * claiming a fresh slot the first time a key shows up.
+ * Returns the slot.
+ */
+int trace_register(const void *handle, const char *key, const char *name) {
+    int free_slot = -1;
+    
+    // hidapi may hand out the address of a closed device again, it belongs to this key now
+    trace_unregister(handle);
+    
+    for(int i = 0; i < TRACE_UNKNOWN_DEVICE; i++) {
+        if(!trace_devices[i].key[0]) {
+            if(free_slot < 0)
+                free_slot = i;
+        }
+        else if(!strcmp(trace_devices[i].key, key)) {
+            trace_devices[i].handle = handle;
+            return i;
+        }
+    }
+    
+    if(free_slot < 0)
+        return TRACE_UNKNOWN_DEVICE;
+    
+    snprintf(trace_devices[free_slot].key, sizeof(trace_devices[free_slot].key), "%s", key);
+    snprintf(trace_devices[free_slot].name, sizeof(trace_devices[free_slot].name), "%s", name);
+    trace_devices[free_slot].handle = handle;
+    return free_slot;
+}
+
+/**
+ * Forgets a hid handle that is about to be closed. The slot
+ * and its counters stay, for when the device comes back.
+ */
+void trace_unregister(const void *handle) {
+    for(int i = 0; i < TRACE_UNKNOWN_DEVICE; i++) {
+        if(handle && trace_devices[i].handle == handle)
+            trace_devices[i].handle = NULL;
+    }
+}
+
+/**
+ * Finds the slot a hid handle was registered to.
+ */
+int trace_lookup(const void *handle) {
+    for(int i = 0; i < TRACE_UNKNOWN_DEVICE; i++) {
+        if(handle && trace_devices[i].handle == handle)
+            return i;
+    }
+    return TRACE_UNKNOWN_DEVICE;
+}
+
+/**
+ * Slow half of TRACE(), only reached with WYATT_TRACE set.
+ */
+void trace_mark(const char *name, int device, long arg) {
+    char line[96];
+    int len = snprintf(line, sizeof(line), "wyatt:%s device=%d arg=%ld\n", name, device, arg);
+    
+    if(len > 0 && write(trace_marker_fd, line, len < (int)sizeof(line) ? len : (int)sizeof(line) - 1) < 0) {
+        close(trace_marker_fd);
+        trace_marker_fd = -1;
+    }
+}
+
+/**
+ * Prints the counters if a SIGUSR1 came in since the last call.
+ * Returns whether it did, so the caller can add its own.
+ */
+bool trace_service(void) {
+    if(!trace_dump_requested) return false;
+    
+    trace_dump_requested = 0;
+    trace_dump();
+    return true;
+}
+
+void trace_dump(void) {
+    for(int i = 0; i < TRACE_MAX_DEVICES; i++) {
+        TraceDevice *dev = &trace_devices[i];
+        if(!dev->name[0]) continue;
+        
+        printf("%-16s %-20s exchanges %llu  reports %llu  subcommands %llu  retries %llu  reconnects %llu\n",
+            dev->name, dev->key,
+            (unsigned long long)atomic_load_explicit(&dev->exchanges, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&dev->reports, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&dev->subcommands, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&dev->retries, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&dev->reconnects, memory_order_relaxed));
+    }
+}
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include "wengine.h"
+
 /* Standard includes */
 #include <stdlib.h>
 #include <stdbool.h>
@@ -11,4 +13,33 @@
 #include <time.h>
 #include <signal.h>
 #include <float.h>
-#include <libudev.h>
\ No newline at end of file
+#include <libudev.h>
+uint64_t wengine_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+long wengine_env_long(const char *name, long fallback) {
+    const char *value = getenv(name);
+    char *end;
+    
+    if(value == NULL || *value == '\0') return fallback;
+    
+    long result = strtol(value, &end, 0);
+    if(*end != '\0') return fallback;
+    
+    return result;
+}
+
+double wengine_env_double(const char *name, double fallback) {
+    const char *value = getenv(name);
+    char *end;
+    
+    if(value == NULL || *value == '\0') return fallback;
+    
+    double result = strtod(value, &end);
+    if(*end != '\0') return fallback;
+    
+    return result;
+}
\ No newline at end of file
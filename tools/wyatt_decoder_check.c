@@ -0,0 +1,202 @@
+/**
+*** :: wyatt_decoder_check.c ::
+***
+***   Runs random reports through the state store and the generated
+***   decoders, the way the combiner does, and through a plain table
+***   driven decoder, the way reports were decoded before either
+***   existed, and complains about every report the two disagree on.
+***   Then has the store decode random batches with and without SIMD,
+***   and complains about every lane that came out different.
+***
+***     wyatt_decoder_check [COUNT]
+***
+***   COUNT is how many reports each decoder and each store path gets,
+***   a million if left out. Exits non-zero if anything differed.
+***
+**/
+
+#include "decoder.h"
+#include "statestore.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const int bits_to_buttons_left[] = {
+    BTN_DPAD_DOWN, BTN_DPAD_UP, BTN_DPAD_RIGHT, BTN_DPAD_LEFT, -1, -1, BTN_TL, BTN_TL2,
+};
+
+static const int bits_to_buttons_right[] = {
+    BTN_WEST, BTN_NORTH, BTN_EAST, BTN_SOUTH, -1, -1, BTN_TR, BTN_TR2,
+};
+
+static const int bits_to_buttons_middle_left[] = {
+    BTN_SELECT, -1, -1, BTN_THUMBL, -1, BTN_Z, -1, -1,
+};
+
+static const int bits_to_buttons_middle_right[] = {
+    -1, BTN_START, BTN_THUMBR, -1, BTN_MODE, -1, -1, -1,
+};
+
+static struct input_event *reference_buttons(struct input_event *ev, const int *map, uint8_t bits) {
+    for(int i = 0; i < 8; i++) {
+        if(map[i] < 0) continue;
+        *ev++ = (struct input_event){.type = EV_KEY, .code = map[i], .value = (bits >> i) & 1};
+    }
+    
+    return ev;
+}
+
+static struct input_event *reference_stick(struct input_event *ev, const uint8_t *sticks, int code_x, int code_y) {
+    *ev++ = (struct input_event){.type = EV_ABS, .code = code_x, .value = ((sticks[1] & 0x0F) << 4) | ((sticks[0] & 0xF0) >> 4)};
+    *ev++ = (struct input_event){.type = EV_ABS, .code = code_y, .value = 256 - sticks[2]};
+    return ev;
+}
+
+/**
+ * Events for the halves in type, left (1) and/or right (2).
+ */
+static int reference_input(struct input_event *events, const InputPacket *input, int type) {
+    struct input_event *ev = events;
+    
+    if(type & 1) {
+        ev = reference_buttons(ev, bits_to_buttons_left, input->buttons_l);
+        ev = reference_buttons(ev, bits_to_buttons_middle_left, input->buttons_middle);
+        ev = reference_stick(ev, &input->sticks[0], ABS_X, ABS_Y);
+    }
+    
+    if(type & 2) {
+        ev = reference_buttons(ev, bits_to_buttons_right, input->buttons_r);
+        ev = reference_buttons(ev, bits_to_buttons_middle_right, input->buttons_middle);
+        ev = reference_stick(ev, &input->sticks[3], ABS_RX, ABS_RY);
+    }
+    
+    return ev - events;
+}
+
+static void reference_state(ControllerState *state, const InputPacket *input, int type) {
+    uint32_t raw = input->buttons_r | (input->buttons_middle << 8) | (input->buttons_l << 16);
+    uint32_t mask = 0;
+    
+    if(type & 1) {
+        mask |= JOYCON_STATE_BUTTONS_LEFT;
+        state->stick_l[0] = input->sticks[0] | ((input->sticks[1] & 0x0F) << 8);
+        state->stick_l[1] = (input->sticks[1] >> 4) | (input->sticks[2] << 4);
+    }
+    
+    if(type & 2) {
+        mask |= JOYCON_STATE_BUTTONS_RIGHT;
+        state->stick_r[0] = input->sticks[3] | ((input->sticks[4] & 0x0F) << 8);
+        state->stick_r[1] = (input->sticks[4] >> 4) | (input->sticks[5] << 4);
+    }
+    
+    state->buttons = (state->buttons & ~mask) | (raw & mask);
+}
+
+static bool same_events(const struct input_event *a, const struct input_event *b, int count) {
+    for(int i = 0; i < count; i++) {
+        if(a[i].type != b[i].type || a[i].code != b[i].code || a[i].value != b[i].value) return false;
+    }
+    
+    return true;
+}
+
+static void random_report(unsigned char *report) {
+    for(size_t i = 0; i < sizeof(InputPacket); i++) report[i] = rand();
+}
+
+/**
+ * Both start from the same random state, so fields the decoder
+ * isn't supposed to touch get checked as well.
+ */
+static long check_decoder(const JoyconDecoder *decoder, long count) {
+    static StateStore store;
+    struct input_event expected[JOYCON_MAX_INPUT_EVENTS], got[JOYCON_MAX_INPUT_EVENTS];
+    unsigned char report[sizeof(InputPacket)];
+    unsigned char *reports[1] = {report};
+    int device = 0;
+    long failures = 0;
+    
+    for(long n = 0; n < count; n++) {
+        random_report(report);
+        
+        ControllerState reference = {rand() | ((uint32_t)rand() << 16), {rand(), rand()}, {rand(), rand()}};
+        ControllerState merged = reference, decoded;
+        
+        int expected_count = reference_input(expected, (const InputPacket*)report, decoder->type);
+        reference_state(&reference, (const InputPacket*)report, decoder->type);
+        
+        // The way the combiner uses them, one decode and everything else from the state
+        statestore_decode(&store, &device, reports, 1, 0);
+        statestore_get(&store, device, &decoded);
+        decoder->merge(&merged, &decoded);
+        int got_count = decoder->emit(got, &merged);
+        
+        bool events_match = expected_count == got_count && same_events(expected, got, got_count);
+        if(events_match && !memcmp(&reference, &merged, sizeof(ControllerState))) continue;
+        
+        if(failures++ < 10) {
+            printf("%s: mismatch on report", decoder->name);
+            for(size_t i = 0; i < sizeof(InputPacket) - sizeof(((InputPacket*)0)->imu); i++) printf(" %02x", report[i]);
+            printf("%s\n", events_match ? " (state)" : " (events)");
+        }
+    }
+    
+    printf("%s: %ld of %ld reports differ\n", decoder->name, failures, count);
+    return failures;
+}
+
+/**
+ * Batches of random size, going either into neighbouring devices,
+ * which is the path that stores whole vectors, or all over the place.
+ */
+static long check_store(long count) {
+    static StateStore vector, scalar;
+    static unsigned char batch[STATESTORE_MAX_DEVICES][sizeof(InputPacket)];
+    unsigned char *reports[STATESTORE_MAX_DEVICES];
+    int devices[STATESTORE_MAX_DEVICES];
+    long failures = 0, batches = 0, reports_done = 0;
+    
+    while(reports_done < count) {
+        int size = 1 + rand() % STATESTORE_MAX_DEVICES;
+        int first = rand() % (STATESTORE_MAX_DEVICES - size + 1);
+        bool neighbours = rand() & 1;
+        
+        for(int i = 0; i < size; i++) {
+            random_report(batch[i]);
+            reports[i] = batch[i];
+            devices[i] = neighbours ? first + i : rand() % STATESTORE_MAX_DEVICES;
+        }
+        
+        // Scattered devices may repeat, the last report wins either way
+        statestore_decode(&vector, devices, reports, size, reports_done);
+        statestore_decode_scalar(&scalar, devices, reports, size, reports_done);
+        reports_done += size;
+        batches++;
+        
+        if(memcmp(&vector, &scalar, sizeof(StateStore)) && failures++ < 10) {
+            printf("store: SIMD and scalar differ on a batch of %d %s devices\n", size, neighbours ? "neighbouring" : "scattered");
+        }
+        
+        // Don't let one bad batch taint all the ones after it
+        vector = scalar;
+    }
+    
+    printf("store: %ld of %ld batches (%ld reports) differ\n", failures, batches, reports_done);
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+    long failures = 0;
+    
+    srand(1);
+    failures += check_decoder(&joycon_decoder_left, count);
+    failures += check_decoder(&joycon_decoder_right, count);
+    failures += check_decoder(&joycon_decoder_pro, count);
+    failures += check_store(count);
+    
+    return failures ? 1 : 0;
+}
\ No newline at end of file
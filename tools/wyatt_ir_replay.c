@@ -0,0 +1,82 @@
+/**
+*** :: wyatt_ir_replay.c ::
+***
+***   Pushes a recorded report stream through the MCU reassembly,
+***   without any controller attached, and writes every completed
+***   IR camera image out as a PGM file.
+***
+***   Input is one report per line in hex_dump format, so the report
+***   lines the poll loop prints (including their "XXms delay,"
+***   prefixes) can be fed in as is. The poll loop dumps every 0x30 and
+***   0x31 report whole, IR fragment included.
+***
+***     wyatt_ir_replay [-u] WIDTH OUT_DIR < reports.txt
+***
+***   -u marks a USB capture, where the report sits behind the
+***   0x81 0x92 header.
+***
+**/
+
+#include "mcu.h"
+#include "hexline.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *out_dir;
+
+static void write_frame(const McuFrame *frame, void *user) {
+    char path[4096];
+    (void)user;
+    
+    snprintf(path, sizeof(path), "%s/ir_%05u.pgm", out_dir, frame->number);
+    FILE *out = fopen(path, "wb");
+    if(out == NULL) {
+        printf("Failed to open %s\n", path);
+        return;
+    }
+    
+    fprintf(out, "P5\n%u %u\n255\n", frame->width, frame->height);
+    fwrite(frame->pixels, 1, frame->size, out);
+    fclose(out);
+}
+
+int main(int argc, char **argv) {
+    static char line[0x2000];
+    uint8_t report[0x400];
+    int offset = 0;
+    int arg = 1;
+    Mcu mcu;
+    
+    if(argc > arg && !strcmp(argv[arg], "-u")) {
+        offset = 0xA;
+        arg++;
+    }
+    
+    if(argc - arg < 2) {
+        fprintf(stderr, "usage: %s [-u] WIDTH OUT_DIR < reports.txt\n", argv[0]);
+        return -1;
+    }
+    
+    out_dir = argv[arg + 1];
+    if(mcu_init(&mcu, atoi(argv[arg]), write_frame, NULL)) return -1;
+    
+    // We're not talking to anyone, but fragments still need to be accepted
+    mcu.streaming = true;
+    
+    while(fgets(line, sizeof(line), stdin)) {
+        int len = hexline_parse(line, report, sizeof(report));
+        if(len > offset) {
+            mcu_feed(&mcu, report + offset, len - offset);
+        }
+    }
+    
+    printf("%llu frames completed, %llu dropped\n",
+        (unsigned long long)mcu.frames_completed, (unsigned long long)mcu.frames_dropped);
+    
+    mcu_free(&mcu);
+    return 0;
+}
\ No newline at end of file
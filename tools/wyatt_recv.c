@@ -0,0 +1,61 @@
+/**
+*** :: wyatt_recv.c ::
+***
+***   Reference receiver for the netstream backend.
+***   Subscribes to a running Wyatt instance and prints every
+***   controller update it gets, one line per update.
+***
+***     wyatt_recv udp:127.0.0.1:9750
+***     wyatt_recv unix:/tmp/wyatt.sock
+***
+**/
+
+#include "netstream.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+/* Holds a whole camera image, too big to live on the stack. */
+static NetStreamReceiver rx;
+
+int main(int argc, char **argv) {    
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s udp:HOST:PORT | unix:PATH\n", argv[0]);
+        return -1;
+    }
+    
+    if(netstream_subscribe(&rx, argv[1])) {
+        fprintf(stderr, "Failed to subscribe to %s\n", argv[1]);
+        return -1;
+    }
+    
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    
+    while(running) {
+        int device = netstream_receive(&rx, 100);
+        if(device < 0) continue;
+        
+        if(rx.last_kind == NETSTREAM_KIND_IMAGE) {
+            printf("dev %d image %5u %ux%u\n", device, rx.image.frame, rx.image.width, rx.image.height);
+            continue;
+        }
+        
+        NetStreamRemoteDevice *dev = &rx.devices[device];
+        printf("dev %d seq %5u %s buttons %06x  L %4u %4u  R %4u %4u  lost %u\n",
+            device, dev->seq, dev->synced ? "   " : "!!!", dev->state.buttons,
+            dev->state.stick_l[0], dev->state.stick_l[1],
+            dev->state.stick_r[0], dev->state.stick_r[1], dev->lost);
+    }
+    
+    netstream_unsubscribe(&rx);
+    return 0;
+}
\ No newline at end of file
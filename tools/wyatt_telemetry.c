@@ -0,0 +1,196 @@
+/**
+*** :: wyatt_telemetry.c ::
+***
+***   Reads back the files the telemetry recorder writes, one line
+***   per IMU sample, or just a summary of what's in them.
+***
+***     wyatt_telemetry [-s] [-d DEVICE] [-f FROM] [-t TO] FILE...
+***
+***   FROM and TO are Unix times in seconds, fractions allowed.
+***   Blocks entirely outside of them are skipped without decoding.
+***   -s prints how many samples each file holds and how well they
+***   compressed, instead of the samples themselves.
+***
+**/
+
+#include "telemetry.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* What the same samples take as plain 0x30/0x31 reports, three IMU readings each. */
+#define RAW_REPORT_SIZE (49)
+
+static int only_device = -1;
+static uint64_t from_us = 0, to_us = UINT64_MAX;
+static bool summary = false;
+
+static TelemetrySample samples[TELEMETRY_BLOCK_SAMPLES];
+static uint8_t payload[TELEMETRY_MAX_BLOCK];
+
+static uint16_t get_u16(const uint8_t *in) {
+    return in[0] | (in[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return get_u16(in) | ((uint32_t)get_u16(in + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *in) {
+    return get_u32(in) | ((uint64_t)get_u32(in + 4) << 32);
+}
+
+static uint64_t parse_time(const char *arg) {
+    return (uint64_t)(strtod(arg, NULL) * 1000000.0);
+}
+
+static void print_sample(const TelemetrySample *sample, uint64_t wall_us) {
+    printf("%llu.%06llu dev %u buttons %06x  L %4u %4u  R %4u %4u  A %6d %6d %6d  G %6d %6d %6d\n",
+        (unsigned long long)(wall_us / 1000000), (unsigned long long)(wall_us % 1000000),
+        sample->device, sample->buttons,
+        sample->sticks[0], sample->sticks[1], sample->sticks[2], sample->sticks[3],
+        sample->accel[0], sample->accel[1], sample->accel[2],
+        sample->gyro[0], sample->gyro[1], sample->gyro[2]);
+}
+
+/**
+ * Goes through one file. Returns 0 on success, -1 if it's
+ * not a telemetry file or turned out damaged.
+ */
+static int read_file(const char *path) {
+    uint8_t header[TELEMETRY_FILE_HEADER];
+    uint64_t total_samples = 0, total_bytes = TELEMETRY_FILE_HEADER;
+    int blocks = 0, res = 0;
+    
+    FILE *in = fopen(path, "rb");
+    if(in == NULL) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+    
+    if(fread(header, sizeof(header), 1, in) != 1 || memcmp(header, TELEMETRY_MAGIC, 4)
+        || get_u16(header + 4) != TELEMETRY_VERSION) {
+        printf("%s isn't a telemetry file\n", path);
+        fclose(in);
+        return -1;
+    }
+    
+    // Samples are stamped with the monotonic clock, the header says where that was on the wall
+    uint64_t mono_us = get_u64(header + 8);
+    uint64_t wall_us = get_u64(header + 16);
+    
+    fseek(in, 0, SEEK_END);
+    long file_size = ftell(in);
+    fseek(in, TELEMETRY_FILE_HEADER, SEEK_SET);
+    
+    while(1) {
+        long offset = ftell(in);
+        size_t got = fread(header, 1, TELEMETRY_BLOCK_HEADER, in);
+        if(got == 0) break;
+        
+        // A recorder that got killed mid write leaves half a block behind
+        if(got < TELEMETRY_BLOCK_HEADER) {
+            printf("%s: block %d at offset %ld is cut off\n", path, blocks, offset);
+            res = -1;
+            break;
+        }
+        
+        int device = header[1];
+        int count = get_u16(header + 2);
+        uint32_t size = get_u32(header + 4);
+        uint64_t first_us = get_u64(header + 8);
+        uint64_t last_us = get_u64(header + 16);
+        
+        if(header[0] != TELEMETRY_BLOCK_MAGIC || size > TELEMETRY_MAX_BLOCK) {
+            printf("%s: damaged block after %d good ones\n", path, blocks);
+            res = -1;
+            break;
+        }
+        
+        if(offset + TELEMETRY_BLOCK_HEADER + (long)size > file_size) {
+            printf("%s: block %d at offset %ld is cut off\n", path, blocks, offset);
+            res = -1;
+            break;
+        }
+        
+        blocks++;
+        total_samples += count;
+        total_bytes += TELEMETRY_BLOCK_HEADER + size;
+        
+        uint64_t first_wall_us = wall_us + (first_us - mono_us);
+        uint64_t last_wall_us = wall_us + (last_us - mono_us);
+        if(summary || last_wall_us < from_us || first_wall_us > to_us
+            || (only_device >= 0 && device != only_device)) {
+            fseek(in, size, SEEK_CUR);
+            continue;
+        }
+        
+        if(fread(payload, size, 1, in) != 1 && size > 0) {
+            printf("%s: block %d at offset %ld is cut off\n", path, blocks - 1, offset);
+            res = -1;
+            break;
+        }
+        if(telemetry_decode_block(payload, size, count, first_us, samples)) {
+            printf("%s: block %d doesn't decode\n", path, blocks - 1);
+            res = -1;
+            break;
+        }
+        
+        for(int i = 0; i < count; i++) {
+            uint64_t sample_wall_us = wall_us + (samples[i].sample_us - mono_us);
+            if(sample_wall_us < from_us || sample_wall_us > to_us) continue;
+            
+            samples[i].device = device;
+            print_sample(&samples[i], sample_wall_us);
+        }
+    }
+    
+    if(summary) {
+        printf("%s: %llu samples in %d blocks, %llu bytes, %.2f bytes per sample (%.1fx smaller than raw reports)\n",
+            path, (unsigned long long)total_samples, blocks, (unsigned long long)total_bytes,
+            total_samples ? (double)total_bytes / total_samples : 0.0,
+            total_bytes ? total_samples * (RAW_REPORT_SIZE / 3.0) / total_bytes : 0.0);
+    }
+    
+    fclose(in);
+    return res;
+}
+
+int main(int argc, char **argv) {
+    int opt, res = 0;
+    
+    while((opt = getopt(argc, argv, "sd:f:t:")) != -1) {
+        switch(opt) {
+            case 's':
+                summary = true;
+                break;
+            case 'd':
+                only_device = atoi(optarg);
+                break;
+            case 'f':
+                from_us = parse_time(optarg);
+                break;
+            case 't':
+                to_us = parse_time(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s] [-d DEVICE] [-f FROM] [-t TO] FILE...\n", argv[0]);
+                return -1;
+        }
+    }
+    
+    if(optind >= argc) {
+        fprintf(stderr, "usage: %s [-s] [-d DEVICE] [-f FROM] [-t TO] FILE...\n", argv[0]);
+        return -1;
+    }
+    
+    for(int i = optind; i < argc; i++) {
+        res |= read_file(argv[i]);
+    }
+    
+    return res;
+}
\ No newline at end of file
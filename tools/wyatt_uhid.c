@@ -0,0 +1,342 @@
+/**
+*** :: wyatt_uhid.c ::
+***
+***   Software controllers for testing without any hardware. Each one
+***   is registered through /dev/uhid, so it gets a real /dev/hidraw
+***   node and hidapi enumerates it like the real thing. The firmware
+***   side of it lives in emulator.c.
+***
+***     wyatt_uhid [-n COUNT] [-w] [-f FLASH] [-s SCRIPT] [-r PERIOD_US] left|right|pro|grip
+***
+***   -n   how many controllers (grips count as one) to create
+***   -w   wired, talk the USB protocol instead of Bluetooth
+***   -f   SPI flash image to answer flash reads from, as dumped by
+***        spi_flash_dump. Writes only ever go to memory.
+***   -s   script or capture to play back, see emulator.c
+***   -r   input report period over Bluetooth
+***
+***   A grip is always wired, and is created as its right half first,
+***   then the left. Without a USB parent neither half has an interface
+***   number, so Wyatt only tells them apart by their names, "Joy-Con (L)"
+***   and "Joy-Con (R)", when run with WYATT_EMULATED_GRIP=1.
+***   Needs write access to /dev/uhid, Ctrl+C removes all the
+***   controllers again.
+***
+***   Everything is registered as a Bluetooth device, since hidapi
+***   skips USB devices that have no USB parent. Wired controllers
+***   get the serial 000000000001 instead of a MAC, which is how Wyatt
+***   tells a USB connection apart.
+***
+**/
+
+#define _GNU_SOURCE
+
+#include "emulator.h"
+#include "wengine.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#define NINTENDO_VENDOR_ID (0x057E)
+
+/**
+ * Vendor defined reports with the same ids and sizes the
+ * real controllers use (sizes without the report id).
+ */
+static const uint8_t report_descriptor[] = {
+    0x06, 0x01, 0xFF,       // Usage Page (Vendor Defined 0xFF01)
+    0x09, 0x21,             // Usage (0x21)
+    0xA1, 0x01,             // Collection (Application)
+    0x15, 0x00,             //   Logical Minimum (0)
+    0x26, 0xFF, 0x00,       //   Logical Maximum (255)
+    0x75, 0x08,             //   Report Size (8)
+    
+    0x85, 0x21, 0x09, 0x21, 0x95, 0x30, 0x81, 0x02,             // Input 0x21, 48 bytes
+    0x85, 0x30, 0x09, 0x30, 0x95, 0x30, 0x81, 0x02,             // Input 0x30, 48 bytes
+    0x85, 0x31, 0x09, 0x31, 0x96, 0x69, 0x01, 0x81, 0x02,       // Input 0x31, 361 bytes
+    0x85, 0x3F, 0x09, 0x3F, 0x95, 0x0B, 0x81, 0x02,             // Input 0x3F, 11 bytes
+    0x85, 0x81, 0x09, 0x81, 0x95, 0x3F, 0x81, 0x02,             // Input 0x81, 63 bytes
+    
+    0x85, 0x01, 0x09, 0x01, 0x95, 0x30, 0x91, 0x02,             // Output 0x01, 48 bytes
+    0x85, 0x10, 0x09, 0x10, 0x95, 0x09, 0x91, 0x02,             // Output 0x10, 9 bytes
+    0x85, 0x11, 0x09, 0x11, 0x95, 0x30, 0x91, 0x02,             // Output 0x11, 48 bytes
+    0x85, 0x80, 0x09, 0x80, 0x95, 0x3F, 0x91, 0x02,             // Output 0x80, 63 bytes
+    0xC0,                   // End Collection
+};
+
+typedef struct controller {
+    int fd;
+    bool open;
+    uint16_t product_id;
+    Emulator em;
+} Controller;
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int signal) {
+    (void)signal;
+    running = 0;
+}
+
+static int uhid_send(int fd, struct uhid_event *ev) {
+    if(write(fd, ev, sizeof(struct uhid_event)) != sizeof(struct uhid_event)) {
+        printf("Failed to write to uhid: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int uhid_input(Controller *ctl, const uint8_t *report, int len) {
+    struct uhid_event ev;
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = len;
+    memcpy(ev.u.input2.data, report, len);
+    
+    return uhid_send(ctl->fd, &ev);
+}
+
+/**
+ * Opens a fresh uhid fd and creates the device behind it.
+ */
+static int uhid_create(Controller *ctl, const char *name, int index) {
+    struct uhid_event ev;
+    
+    ctl->fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if(ctl->fd < 0) {
+        printf("Failed to open /dev/uhid: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    snprintf((char*)ev.u.create2.name, sizeof(ev.u.create2.name), "%s", name);
+    snprintf((char*)ev.u.create2.phys, sizeof(ev.u.create2.phys), "wyatt-uhid/%d", index);
+    if(ctl->em.wired)
+        snprintf((char*)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "000000000001");
+    else
+        snprintf((char*)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%02x:%02x:%02x:%02x:%02x:%02x",
+            ctl->em.mac[0], ctl->em.mac[1], ctl->em.mac[2], ctl->em.mac[3], ctl->em.mac[4], ctl->em.mac[5]);
+    
+    memcpy(ev.u.create2.rd_data, report_descriptor, sizeof(report_descriptor));
+    ev.u.create2.rd_size = sizeof(report_descriptor);
+    ev.u.create2.bus = BUS_BLUETOOTH;
+    ev.u.create2.vendor = NINTENDO_VENDOR_ID;
+    ev.u.create2.product = ctl->product_id;
+    ev.u.create2.version = 0x0001;
+    
+    return uhid_send(ctl->fd, &ev);
+}
+
+/**
+ * Handles one event from the kernel side of a device.
+ */
+static void uhid_service(Controller *ctl, uint64_t now_us) {
+    struct uhid_event ev;
+    uint8_t reply[EMULATOR_MAX_REPORT];
+    int len;
+    
+    if(read(ctl->fd, &ev, sizeof(ev)) <= 0) return;
+    
+    switch(ev.type) {
+        case UHID_OPEN:
+            ctl->open = true;
+            ctl->em.next_report_us = now_us;
+            break;
+        case UHID_CLOSE:
+            ctl->open = false;
+            break;
+        case UHID_OUTPUT:
+            len = emulator_output(&ctl->em, ev.u.output.data, ev.u.output.size, reply, now_us);
+            if(len > 0)
+                uhid_input(ctl, reply, len);
+            break;
+        case UHID_GET_REPORT: {
+            // Neither feature nor input reports can be fetched on request
+            uint32_t id = ev.u.get_report.id;
+            memset(&ev, 0, sizeof(ev));
+            ev.type = UHID_GET_REPORT_REPLY;
+            ev.u.get_report_reply.id = id;
+            ev.u.get_report_reply.err = EIO;
+            uhid_send(ctl->fd, &ev);
+            break;
+        }
+        case UHID_SET_REPORT: {
+            uint32_t id = ev.u.set_report.id;
+            memset(&ev, 0, sizeof(ev));
+            ev.type = UHID_SET_REPORT_REPLY;
+            ev.u.set_report_reply.id = id;
+            ev.u.set_report_reply.err = EIO;
+            uhid_send(ctl->fd, &ev);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n COUNT] [-w] [-f FLASH] [-s SCRIPT] [-r PERIOD_US] left|right|pro|grip\n", name);
+}
+
+int main(int argc, char **argv) {
+    int count = 1;
+    bool wired = false;
+    const char *flash_path = NULL;
+    const char *script_path = NULL;
+    long period_us = EMULATOR_DEFAULT_PERIOD_US;
+    EmulatorScript script = {0, NULL};
+    int opt;
+    
+    while((opt = getopt(argc, argv, "n:wf:s:r:")) != -1) {
+        switch(opt) {
+            case 'n': count = atoi(optarg); break;
+            case 'w': wired = true; break;
+            case 'f': flash_path = optarg; break;
+            case 's': script_path = optarg; break;
+            case 'r': period_us = atol(optarg); break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    
+    if(optind != argc - 1 || count < 1 || period_us <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    
+    const char *kind = argv[optind];
+    bool grip = !strcmp(kind, "grip");
+    int per_count = grip ? 2 : 1;
+    
+    if(!grip && strcmp(kind, "left") && strcmp(kind, "right") && strcmp(kind, "pro")) {
+        usage(argv[0]);
+        return -1;
+    }
+    
+    if(script_path && emulator_script_load(&script, script_path)) return -1;
+    
+    int num_controllers = count * per_count;
+    Controller *controllers = (Controller*)calloc(num_controllers, sizeof(Controller));
+    struct pollfd *fds = (struct pollfd*)calloc(num_controllers, sizeof(struct pollfd));
+    if(controllers == NULL || fds == NULL) return -1;
+    
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    
+    int created = 0;
+    uint64_t now_us = wengine_now_us();
+    for(int i = 0; i < num_controllers; i++) {
+        Controller *ctl = &controllers[i];
+        EmulatorKind emulated;
+        const char *name;
+        
+        if(grip) {
+            emulated = i % 2 ? EMULATOR_JOYCON_L : EMULATOR_JOYCON_R;
+            name = i % 2 ? "Joy-Con (L)" : "Joy-Con (R)";
+            ctl->product_id = 0x200E;
+        }
+        else if(!strcmp(kind, "left")) {
+            emulated = EMULATOR_JOYCON_L;
+            name = "Joy-Con (L)";
+            ctl->product_id = 0x2006;
+        }
+        else if(!strcmp(kind, "right")) {
+            emulated = EMULATOR_JOYCON_R;
+            name = "Joy-Con (R)";
+            ctl->product_id = 0x2007;
+        }
+        else {
+            emulated = EMULATOR_PRO;
+            name = "Pro Controller";
+            ctl->product_id = 0x2009;
+        }
+        
+        if(emulator_init(&ctl->em, emulated, grip || wired, i, flash_path)) break;
+        ctl->em.period_us = period_us;
+        emulator_attach_script(&ctl->em, script_path ? &script : NULL, now_us);
+        
+        if(uhid_create(ctl, name, i)) {
+            emulator_free(&ctl->em);
+            break;
+        }
+        
+        fds[i].fd = ctl->fd;
+        fds[i].events = POLLIN;
+        created++;
+    }
+    
+    printf("Emulating %d controller%s\n", created, created == 1 ? "" : "s");
+    
+    while(running && created == num_controllers) {
+        uint8_t report[EMULATOR_MAX_REPORT];
+        uint64_t next_us = UINT64_MAX;
+        
+        // Sleep until the first controller is due to send something
+        now_us = wengine_now_us();
+        for(int i = 0; i < num_controllers; i++) {
+            Controller *ctl = &controllers[i];
+            if(ctl->open && !ctl->em.wired && ctl->em.next_report_us < next_us)
+                next_us = ctl->em.next_report_us;
+        }
+        
+        struct timespec timeout = {1, 0};
+        if(next_us != UINT64_MAX) {
+            uint64_t wait_us = next_us > now_us ? next_us - now_us : 0;
+            timeout.tv_sec = wait_us / 1000000;
+            timeout.tv_nsec = (wait_us % 1000000) * 1000;
+        }
+        
+        if(ppoll(fds, num_controllers, &timeout, NULL) < 0 && errno != EINTR) {
+            printf("ppoll failed: %s\n", strerror(errno));
+            break;
+        }
+        
+        now_us = wengine_now_us();
+        for(int i = 0; i < num_controllers; i++) {
+            Controller *ctl = &controllers[i];
+            
+            if(fds[i].revents & POLLIN)
+                uhid_service(ctl, now_us);
+            
+            int len = ctl->open ? emulator_poll(&ctl->em, report, now_us) : 0;
+            if(len > 0)
+                uhid_input(ctl, report, len);
+        }
+    }
+    
+    uint64_t reports = 0, subcommands = 0;
+    for(int i = 0; i < created; i++) {
+        Controller *ctl = &controllers[i];
+        struct uhid_event ev;
+        
+        reports += ctl->em.reports_sent;
+        subcommands += ctl->em.subcommands_answered;
+        
+        memset(&ev, 0, sizeof(ev));
+        ev.type = UHID_DESTROY;
+        uhid_send(ctl->fd, &ev);
+        close(ctl->fd);
+        emulator_free(&ctl->em);
+    }
+    
+    printf("Sent %llu input reports, answered %llu subcommands\n",
+        (unsigned long long)reports, (unsigned long long)subcommands);
+    
+    free(fds);
+    free(controllers);
+    emulator_script_free(&script);
+    return 0;
+}
\ No newline at end of file